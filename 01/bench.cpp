@@ -0,0 +1,231 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <random>
+
+#include "primes.h"
+#include "counter.h"
+#include "dataset.h"
+#include "search.h"
+
+#define MAX_N 100000
+
+/* Reference sieve: one int per number, whole range in one pass */
+class TablePrimes {
+    int *prime;
+    uint64_t n;
+public:
+    TablePrimes(uint64_t max_prime)
+    {
+        n = max_prime;
+        prime = new int[n+1];
+        std::fill(prime, &prime[n+1], 1);
+        prime[0] = 0;
+        prime[1] = 0;
+
+        for (uint64_t i = 4; i <= n; i += 2)
+            prime[i] = 0;
+
+        for (uint64_t p = 3; p <= n; p += 2)
+            if (prime[p] == 1)
+                for (uint64_t i = 2*p; i <= n; i += p)
+                    prime[i] = 0;
+    }
+
+    ~TablePrimes()
+    {
+        delete[] prime;
+    }
+
+    int
+    operator[](uint64_t i) const
+    {
+        return prime[i];
+    }
+
+    size_t
+    memory() const
+    {
+        return (n + 1) * sizeof(int);
+    }
+};
+
+template <class T>
+double
+build_time(uint64_t n, size_t &memory, uint64_t &count)
+{
+    auto start = std::chrono::steady_clock::now();
+    T primes(n);
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    memory = primes.memory();
+    count = 0;
+    for (uint64_t i = 0; i <= n; ++i)
+        count += primes[i];
+    return sec;
+}
+
+/* compile-time table against the runtime sieve, number by number */
+template <uint64_t N>
+bool
+same_as_sieve()
+{
+    StaticPrimes<N> table;
+    Primes sieve(N);
+    for (uint64_t i = 0; i <= N; ++i) {
+        if (table[i] != sieve[i]) {
+            std::cerr << "StaticPrimes<" << N << "> differs from Primes at " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+bench_sieve(uint64_t max_limit)
+{
+    if (!same_as_sieve<MAX_N>() || !same_as_sieve<STATIC_PRIMES_MAX>())
+        return 1;
+
+    uint64_t limits[] = { 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+    std::cout << "limit\ttable_bytes\ttable_sec\tsegmented_bytes\tsegmented_sec\tprimes" << std::endl;
+    for (uint64_t n : limits) {
+        if (n > max_limit)
+            break;
+        size_t table_mem, seg_mem;
+        uint64_t table_cnt, seg_cnt;
+        double table_sec = build_time<TablePrimes>(n, table_mem, table_cnt);
+        double seg_sec = build_time<Primes>(n, seg_mem, seg_cnt);
+        if (table_cnt != seg_cnt) {
+            std::cerr << "mismatch at limit " << n << ": " << table_cnt << " != " << seg_cnt << std::endl;
+            return 1;
+        }
+        std::cout << n << '\t' << table_mem << '\t' << table_sec << '\t'
+                  << seg_mem << '\t' << seg_sec << '\t' << seg_cnt << std::endl;
+    }
+    return 0;
+}
+
+/* random pairs of dataset values, so that most queries hit */
+std::vector<int>
+make_queries(const Dataset &data, size_t n)
+{
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> pos(0, data.size() - 1);
+    std::vector<int> v(2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        int a = data.data()[pos(gen)];
+        int b = data.data()[pos(gen)];
+        v[2*i] = std::min(a, b);
+        v[2*i + 1] = std::max(a, b);
+    }
+    return v;
+}
+
+int
+bench_queries(const char *dataset, size_t n)
+{
+    Dataset data(dataset);
+    Primes prime(MAX_N);
+    PrimeCounter counter(data.data(), data.size(), prime, MAX_N);
+    std::vector<int> v = make_queries(data, n);
+
+    std::vector<int> expected;
+    count_parallel(counter, v, expected, 1);
+
+    std::cout << "threads\tqueries_per_sec" << std::endl;
+    for (unsigned threads : { 1, 2, 4, 8 }) {
+        std::vector<int> res;
+        auto start = std::chrono::steady_clock::now();
+        count_parallel(counter, v, res, threads);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (res != expected) {
+            std::cerr << "mismatch at " << threads << " threads" << std::endl;
+            return 1;
+        }
+        std::cout << threads << '\t' << n / sec << std::endl;
+    }
+    return 0;
+}
+
+template <class F>
+double
+search_time(const std::vector<int> &q, F search, uint64_t &sum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int x : q)
+        sum += search(x);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int
+bench_search(const char *dataset, size_t n)
+{
+    Dataset data(dataset);
+    const int *beg = data.data();
+    const int *end = beg + data.size();
+    SearchIndex index(beg, data.size());
+    index.add_eytzinger();
+
+    /* queries follow the dataset distribution, plus values around its borders */
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> pos(0, data.size() - 1);
+    std::uniform_int_distribution<int> delta(-1, 1);
+    std::vector<int> q(n);
+    for (size_t i = 0; i < n; ++i)
+        q[i] = beg[pos(gen)] + delta(gen);
+
+    for (int x = beg[0] - 2; x <= end[-1] + 2; ++x) {
+        if (index.lower_bound_eytzinger(x) != std::lower_bound(beg, end, x)
+                || index.lower_bound(x) != std::lower_bound(beg, end, x)
+                || index.upper_bound(x) != std::upper_bound(beg, end, x)) {
+            std::cerr << "mismatch at " << x << std::endl;
+            return 1;
+        }
+    }
+
+    uint64_t s1 = 0, s2 = 0, s3 = 0;
+    std::cout << "kernel\tns_per_search" << std::endl;
+    double t = search_time(q, [&](int x) { return std::lower_bound(beg, end, x) - beg; }, s1);
+    std::cout << "std\t" << t * 1e9 / n << std::endl;
+    t = search_time(q, [&](int x) { return index.lower_bound_eytzinger(x) - beg; }, s2);
+    std::cout << "eytzinger\t" << t * 1e9 / n << std::endl;
+    t = search_time(q, [&](int x) { return index.lower_bound(x) - beg; }, s3);
+#ifdef __AVX2__
+    std::cout << "btree_avx2\t" << t * 1e9 / n << std::endl;
+#else
+    std::cout << "default\t" << t * 1e9 / n << std::endl;
+#endif
+    if (s1 != s2 || s1 != s3) {
+        std::cerr << "checksum mismatch" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    try {
+        if (mode == "sieve")
+            return bench_sieve(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000000);
+        if (mode == "queries" && argc > 2)
+            return bench_queries(argv[2], argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10000000);
+        if (mode == "search" && argc > 2)
+            return bench_search(argv[2], argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10000000);
+    }
+    catch (DatasetError &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "Usage: bench sieve [max_limit]" << std::endl;
+    std::cerr << "       bench queries numbers.bin [queries]" << std::endl;
+    std::cerr << "       bench search numbers.bin [searches]" << std::endl;
+    return 1;
+}
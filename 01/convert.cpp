@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <climits>
+#include <cstring>
+
+#include "dataset.h"
+#include "counter.h"
+#include "primes.h"
+
+/* Converts text dataset (numbers.dat, C array initializer) to binary format,
+ * precomputing prime counts up to max_n and search layouts, so that readers
+ * only map them */
+
+#define MAX_N 100000
+
+/* numbers between the first '{' and the following '}' */
+bool
+parse_text(const std::string &text, std::vector<int32_t> &v)
+{
+    size_t beg = text.find('{');
+    size_t end = text.find('}', beg);
+    if (beg == std::string::npos || end == std::string::npos)
+        return false;
+
+    const char *p = text.c_str() + beg + 1;
+    const char *stop = text.c_str() + end;
+    while (p < stop) {
+        if (std::isdigit(*p) || *p == '-') {
+            char *next;
+            v.push_back(std::strtol(p, &next, 10));
+            p = next;
+        } else {
+            ++p;
+        }
+    }
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: convert numbers.dat numbers.bin [max_n]" << std::endl;
+        return 1;
+    }
+    long max_n = argc == 4 ? std::strtol(argv[3], nullptr, 10) : MAX_N;
+    if (max_n < 0 || max_n > INT_MAX) {
+        std::cerr << "Bad max_n " << argv[3] << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1]);
+    if (!in.is_open()) {
+        std::cerr << "Can't open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<int32_t> v;
+    if (!parse_text(text, v)) {
+        std::cerr << "Can't parse " << argv[1] << std::endl;
+        return 1;
+    }
+    if (!std::is_sorted(v.begin(), v.end())) {
+        std::cerr << "Data in " << argv[1] << " is not sorted" << std::endl;
+        return 1;
+    }
+
+    if (v.size() > UINT32_MAX) {
+        std::cerr << "Too many values in " << argv[1] << std::endl;
+        return 1;
+    }
+
+    DatasetHeader header;
+    std::copy(DatasetMagic, DatasetMagic + sizeof DatasetMagic, header.magic);
+    header.count = v.size();
+    header.max_n = max_n;
+    uint64_t length = dataset_layout(header);
+
+    /* zeroed file image in Node units, so the B-tree is built in place aligned */
+    std::vector<SearchIndex::Node> image((length + sizeof(SearchIndex::Node) - 1) / sizeof(SearchIndex::Node));
+    char *base = reinterpret_cast<char *>(image.data());
+    int32_t *values = reinterpret_cast<int32_t *>(base + sizeof header);
+    std::copy(v.begin(), v.end(), values);
+
+    /* the default limit is sieved at compile time */
+    uint32_t *prefix = reinterpret_cast<uint32_t *>(base + header.prefix);
+    if (max_n == MAX_N)
+        PrimeCounter::build_prefix(values, v.size(), prime_table<MAX_N>(), max_n, prefix);
+    else
+        PrimeCounter::build_prefix(values, v.size(), Primes(max_n), max_n, prefix);
+    SearchIndex::build_eytzinger(values, v.size(), reinterpret_cast<int32_t *>(base + header.eytz),
+            reinterpret_cast<uint32_t *>(base + header.eytz_pos));
+    SearchIndex::build_btree(values, v.size(), reinterpret_cast<SearchIndex::Node *>(base + header.btree),
+            reinterpret_cast<uint32_t *>(base + header.btree_pos));
+
+    header.checksum = dataset_checksum(values, (length - sizeof header) / sizeof(int32_t));
+    std::memcpy(base, &header, sizeof header);
+
+    std::ofstream out(argv[2], std::ios::binary);
+    out.write(base, length);
+    out.close();
+    if (!out) {
+        std::cerr << "Can't write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    /* read back what readers will map */
+    try {
+        Dataset written(argv[2], true);
+    }
+    catch (DatasetError &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
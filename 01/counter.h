@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include "search.h"
+#include "dataset.h"
+
+/* Counts primes among Data elements whose values lie in [l, r].
+ * prefix[i] holds the number of primes in data[0..i), so each query
+ * costs two searches in SearchIndex and one subtraction. Tables are
+ * either built at construction or mapped from a converted Dataset. */
+class PrimeCounter {
+    const int *data;
+    size_t size;
+    int max_n;
+    std::vector<uint32_t> prefix_buf;
+    const uint32_t *prefix;
+    SearchIndex index;
+
+public:
+    /* writes size + 1 prefix counts */
+    template <class P>
+    static void
+    build_prefix(const int *data, size_t size, const P &prime, int max_n, uint32_t *prefix)
+    {
+        prefix[0] = 0;
+        for (size_t i = 0; i < size; ++i) {
+            int x = data[i];
+            prefix[i+1] = prefix[i] + (x >= 0 && x <= max_n && prime[x]);
+        }
+    }
+
+    template <class P>
+    PrimeCounter(const int *data, size_t size, const P &prime, int max_n):
+        data(data), size(size), max_n(max_n), prefix_buf(size + 1), prefix(prefix_buf.data()),
+        index(data, size)
+    {
+        build_prefix(data, size, prime, max_n, prefix_buf.data());
+    }
+
+    /* Nothing is computed, so construction time does not depend on the
+     * dataset size; the dataset must have been converted for max_n */
+    PrimeCounter(const Dataset &dataset, int max_n):
+        data(dataset.data()), size(dataset.size()), max_n(max_n), prefix(dataset.prefix()),
+        index(data, size, dataset.eytzinger(), dataset.eytzinger_pos(), dataset.btree(), dataset.btree_pos())
+    {
+        if (dataset.max_n() != uint64_t(max_n))
+            throw DatasetError("dataset counts primes up to " + std::to_string(dataset.max_n()) +
+                    ", expected " + std::to_string(max_n));
+    }
+
+    /* 0 when l or r is not present in data or lies outside [0, max_n] */
+    int
+    count(int l, int r) const
+    {
+        const int *end_data = data + size;
+        const int *beg = index.lower_bound(l);
+        const int *end = index.upper_bound(r);
+
+        if (beg == end_data || beg[0] != l || l < 0
+              || end == data || end[-1] != r || r > max_n)
+            return 0;
+        if (beg >= end)
+            return 0;
+        return prefix[end - data] - prefix[beg - data];
+    }
+};
+
+/* Resolves pairs (v[2i], v[2i+1]) into res[i], splitting them into
+ * contiguous chunks across threads; the tables are only read. */
+inline void
+count_parallel(const PrimeCounter &counter, const std::vector<int> &v, std::vector<int> &res, unsigned threads)
+{
+    size_t n = v.size() / 2;
+    res.resize(n);
+    if (threads < 1)
+        threads = 1;
+
+    auto work = [&](size_t beg, size_t end) {
+        for (size_t i = beg; i < end; ++i)
+            res[i] = counter.count(v[i*2], v[i*2 + 1]);
+    };
+
+    std::vector<std::thread> pool;
+    size_t chunk = (n + threads - 1) / threads;
+    for (unsigned t = 1; t < threads && t * chunk < n; ++t)
+        pool.emplace_back(work, t * chunk, std::min(n, (t + 1) * chunk));
+    work(0, std::min(n, chunk));
+    for (auto &t : pool)
+        t.join();
+}
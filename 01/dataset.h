@@ -0,0 +1,194 @@
+#pragma once
+
+#include <string>
+#include <exception>
+
+#include <cstdint>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "search.h"
+
+/* Binary dataset: header followed by count sorted int32 values, then
+ * tables derived from them by convert: count + 1 prefix counts of primes
+ * up to max_n (see PrimeCounter) and both SearchIndex layouts. Sections
+ * start at DatasetAlign boundaries, their offsets follow from count. */
+struct DatasetHeader {
+    char magic[8];
+    uint64_t count;
+    /* over everything after the header */
+    uint64_t checksum;
+    uint64_t max_n;
+    uint64_t prefix;
+    uint64_t eytz;
+    uint64_t eytz_pos;
+    uint64_t btree;
+    uint64_t btree_pos;
+};
+
+static constexpr char DatasetMagic[8] = { 'P', 'R', 'I', 'M', 'E', 'D', 'A', 'T' };
+static constexpr uint64_t DatasetAlign = 64;
+
+/* Sets section offsets of h for h.count values, returns the file size */
+inline uint64_t
+dataset_layout(DatasetHeader &h)
+{
+    auto align = [](uint64_t x) { return (x + DatasetAlign - 1) / DatasetAlign * DatasetAlign; };
+    uint64_t n = h.count;
+    uint64_t end = sizeof(DatasetHeader) + n * sizeof(int32_t);
+    h.prefix = align(end);
+    end = h.prefix + (n + 1) * sizeof(uint32_t);
+    h.eytz = align(end);
+    end = h.eytz + SearchIndex::eytzinger_size(n) * sizeof(int32_t);
+    h.eytz_pos = align(end);
+    end = h.eytz_pos + SearchIndex::eytzinger_size(n) * sizeof(uint32_t);
+    h.btree = align(end);
+    end = h.btree + SearchIndex::btree_nodes(n) * sizeof(SearchIndex::Node);
+    h.btree_pos = align(end);
+    return h.btree_pos + SearchIndex::btree_pos_size(n) * sizeof(uint32_t);
+}
+
+/* FNV-1a over 32-bit words */
+inline uint64_t
+dataset_checksum(const int32_t *data, size_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= uint32_t(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+class DatasetError: public std::exception {
+    std::string message;
+public:
+    DatasetError(const std::string &message): message("DatasetError: " + message) { }
+    virtual const char *what() const noexcept
+    {
+        return message.c_str();
+    }
+};
+
+/* Read-only mapping of a binary dataset. Opening checks only the header
+ * and the file size, so it does not depend on the number of values;
+ * checksum is verified on demand or, when asked, on open. */
+class Dataset {
+    int fd;
+    size_t length;
+    void *ptr;
+    const DatasetHeader *header;
+
+    Dataset(const Dataset &);
+    Dataset &operator=(const Dataset &);
+
+    template <class T>
+    const T *
+    section(uint64_t offset) const
+    {
+        return reinterpret_cast<const T *>(static_cast<const char *>(ptr) + offset);
+    }
+public:
+    Dataset(const std::string &filename, bool check=false): ptr(MAP_FAILED)
+    {
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw DatasetError("can't open file '" + filename + "'. errno=" + std::to_string(errno));
+
+        struct stat st;
+        if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(DatasetHeader)) {
+            close(fd);
+            throw DatasetError("invalid size of file '" + filename + "'");
+        }
+        length = st.st_size;
+
+        ptr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            throw DatasetError("can't mmap file '" + filename + "'. errno=" + std::to_string(errno));
+        }
+
+        header = static_cast<const DatasetHeader *>(ptr);
+        DatasetHeader expected = *header;
+        if (std::memcmp(header->magic, DatasetMagic, sizeof DatasetMagic)
+                || header->count > UINT32_MAX
+                || dataset_layout(expected) != length
+                || std::memcmp(&expected, header, sizeof expected)) {
+            munmap(ptr, length);
+            close(fd);
+            throw DatasetError("bad header in file '" + filename + "'");
+        }
+        if (check && !verify()) {
+            munmap(ptr, length);
+            close(fd);
+            throw DatasetError("bad checksum in file '" + filename + "'");
+        }
+    }
+
+    ~Dataset()
+    {
+        munmap(ptr, length);
+        close(fd);
+    }
+
+    const int32_t *
+    data() const
+    {
+        return reinterpret_cast<const int32_t *>(header + 1);
+    }
+
+    size_t
+    size() const
+    {
+        return header->count;
+    }
+
+    /* primes counted by prefix() are those up to max_n() */
+    uint64_t
+    max_n() const
+    {
+        return header->max_n;
+    }
+
+    const uint32_t *
+    prefix() const
+    {
+        return section<uint32_t>(header->prefix);
+    }
+
+    const int32_t *
+    eytzinger() const
+    {
+        return section<int32_t>(header->eytz);
+    }
+
+    const uint32_t *
+    eytzinger_pos() const
+    {
+        return section<uint32_t>(header->eytz_pos);
+    }
+
+    const SearchIndex::Node *
+    btree() const
+    {
+        return section<SearchIndex::Node>(header->btree);
+    }
+
+    const uint32_t *
+    btree_pos() const
+    {
+        return section<uint32_t>(header->btree_pos);
+    }
+
+    bool
+    verify() const
+    {
+        return dataset_checksum(reinterpret_cast<const int32_t *>(header + 1),
+                (length - sizeof(DatasetHeader)) / sizeof(int32_t)) == header->checksum;
+    }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+/* Primality test for numbers in range [0, max_prime] using segmented sieve of Eratosthenes.
+ * Only odd numbers are stored, one bit per number: bit k is set when 2k+1 is composite.
+ * Sieving goes in blocks of SEGMENT_BITS bits, so the working set stays in L1 cache. */
+class Primes {
+    static const uint64_t SEGMENT_BITS = 32 * 1024 * 8;
+
+    std::vector<uint64_t> composite;
+    uint64_t n;
+
+    void mark(uint64_t k)
+    {
+        composite[k / 64] |= uint64_t(1) << (k % 64);
+    }
+
+    /* odd primes p with p*p <= n, found by plain sieve up to sqrt(n) */
+    std::vector<uint64_t> base_primes() const
+    {
+        uint64_t root = 1;
+        while ((root + 1) * (root + 1) <= n)
+            ++root;
+
+        std::vector<char> small(root + 1, 1);
+        std::vector<uint64_t> res;
+        for (uint64_t p = 3; p <= root; p += 2) {
+            if (!small[p])
+                continue;
+            res.push_back(p);
+            for (uint64_t i = p * p; i <= root; i += 2 * p)
+                small[i] = 0;
+        }
+        return res;
+    }
+
+public:
+    Primes(uint64_t max_prime): n(max_prime)
+    {
+        uint64_t bits = (n + 1) / 2;
+        composite.assign(bits / 64 + 1, 0);
+        /* 1 is not prime */
+        mark(0);
+
+        std::vector<uint64_t> base = base_primes();
+        /* next[i] is the bit of the next odd multiple of base[i] to cross out */
+        std::vector<uint64_t> next(base.size());
+        for (size_t i = 0; i < base.size(); ++i)
+            next[i] = base[i] * base[i] / 2;
+
+        for (uint64_t lo = 0; lo < bits; lo += SEGMENT_BITS) {
+            uint64_t hi = std::min(lo + SEGMENT_BITS, bits);
+            for (size_t i = 0; i < base.size(); ++i) {
+                uint64_t k = next[i];
+                uint64_t p = base[i];
+                for (; k < hi; k += p)
+                    mark(k);
+                next[i] = k;
+            }
+        }
+    }
+
+    int
+    operator[](uint64_t i) const
+    {
+        /* we could add border check */
+        if (i % 2 == 0)
+            return i == 2;
+        uint64_t k = i / 2;
+        return !((composite[k / 64] >> (k % 64)) & 1);
+    }
+
+    size_t
+    memory() const
+    {
+        return composite.size() * sizeof(composite[0]);
+    }
+};
+
+/* Limits up to this value are sieved at compile time */
+#ifndef STATIC_PRIMES_MAX
+#define STATIC_PRIMES_MAX 1000000
+#endif
+
+/* Same bit layout as Primes, but the table is built by constexpr sieve
+ * and placed into .rodata, so construction does no work at run time. */
+template <uint64_t N>
+class StaticPrimes {
+    static const uint64_t BITS = (N + 1) / 2;
+    static const size_t WORDS = BITS / 64 + 1;
+
+    struct Table {
+        uint64_t composite[WORDS];
+    };
+
+    static constexpr Table
+    build()
+    {
+        Table t {};
+        t.composite[0] |= 1;
+        for (uint64_t p = 3; p * p <= N; p += 2) {
+            if ((t.composite[p / 2 / 64] >> (p / 2 % 64)) & 1)
+                continue;
+            for (uint64_t k = p * p / 2; k < BITS; k += p)
+                t.composite[k / 64] |= uint64_t(1) << (k % 64);
+        }
+        return t;
+    }
+
+    static constexpr Table table = build();
+
+public:
+    int
+    operator[](uint64_t i) const
+    {
+        if (i % 2 == 0)
+            return i == 2;
+        uint64_t k = i / 2;
+        return !((table.composite[k / 64] >> (k % 64)) & 1);
+    }
+
+    size_t
+    memory() const
+    {
+        return sizeof table;
+    }
+};
+
+/* StaticPrimes when the limit is small enough, runtime sieve otherwise */
+template <uint64_t N>
+using PrimeTable = typename std::conditional<(N <= STATIC_PRIMES_MAX), StaticPrimes<N>, Primes>::type;
+
+/* the two tables take different constructor arguments */
+template <uint64_t N>
+PrimeTable<N>
+prime_table()
+{
+    if constexpr (N <= STATIC_PRIMES_MAX)
+        return StaticPrimes<N>();
+    else
+        return Primes(N);
+}
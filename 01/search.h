@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Branchless lower_bound/upper_bound over sorted int array.
+ * Results are the same pointers std::lower_bound/std::upper_bound return.
+ *
+ * Scalar kernel walks Eytzinger (BFS) layout: node k has children 2k and 2k+1,
+ * so the next four levels share one cache line and can be prefetched.
+ * AVX2 kernel walks static B-tree of 8-key nodes (node k has children k*9+1..k*9+9),
+ * comparing whole node with one instruction. Both layouts store for every slot
+ * its position in the original array. Eytzinger kernel needs add_eytzinger()
+ * when AVX2 is on. */
+class SearchIndex {
+public:
+    static const size_t B = 8;
+
+    struct alignas(32) Node {
+        int key[B];
+    };
+
+    /* slots of each layout for size values */
+    static size_t eytzinger_size(size_t size)
+    {
+        return size + 1;
+    }
+
+    static size_t btree_nodes(size_t size)
+    {
+        return (size + B - 1) / B;
+    }
+
+    /* one extra node, so pos of slot B of the last node can be read */
+    static size_t btree_pos_size(size_t size)
+    {
+        return (btree_nodes(size) + 1) * B;
+    }
+
+    /* Layouts are built into caller's arrays of the sizes above, so they
+     * can be stored next to the data, see Dataset */
+    static void build_eytzinger(const int *data, size_t size, int *eytz, uint32_t *pos)
+    {
+        size_t t = 0;
+        fill_eytzinger(data, size, eytz, pos, 1, t);
+        /* k == 0 after the descent means "not found" */
+        eytz[0] = 0;
+        pos[0] = size;
+    }
+
+    static void build_btree(const int *data, size_t size, Node *btree, uint32_t *pos)
+    {
+        /* unused slots are placed after all real keys in tree order */
+        size_t nblocks = btree_nodes(size);
+        for (size_t k = 0; k < nblocks; ++k)
+            for (size_t i = 0; i < B; ++i)
+                btree[k].key[i] = INT_MAX;
+        std::fill(pos, pos + btree_pos_size(size), uint32_t(size));
+        size_t t = 0;
+        fill_btree(data, size, btree, pos, 0, t);
+    }
+
+private:
+    const int *data;
+    size_t size;
+    size_t nblocks;
+
+    /* layouts built by this object; mapped ones are only pointed to */
+    std::vector<int> eytz_buf;
+    std::vector<uint32_t> eytz_pos_buf;
+    std::vector<Node> btree_buf;
+    std::vector<uint32_t> btree_pos_buf;
+
+    const int *eytz;
+    const uint32_t *eytz_pos;
+    const Node *btree;
+    const uint32_t *btree_pos;
+
+    static void fill_eytzinger(const int *data, size_t size, int *eytz, uint32_t *pos, size_t k, size_t &t)
+    {
+        if (k > size)
+            return;
+        fill_eytzinger(data, size, eytz, pos, 2*k, t);
+        eytz[k] = data[t];
+        pos[k] = t++;
+        fill_eytzinger(data, size, eytz, pos, 2*k + 1, t);
+    }
+
+    static void fill_btree(const int *data, size_t size, Node *btree, uint32_t *pos, size_t k, size_t &t)
+    {
+        if (k >= btree_nodes(size))
+            return;
+        for (size_t i = 0; i <= B; ++i) {
+            fill_btree(data, size, btree, pos, k * (B+1) + i + 1, t);
+            if (i < B && t < size) {
+                btree[k].key[i] = data[t];
+                pos[k*B + i] = t++;
+            }
+        }
+    }
+
+    SearchIndex(const SearchIndex &);
+    SearchIndex &operator=(const SearchIndex &);
+public:
+    /* Builds only the layout lower_bound() walks; positions are 32-bit,
+     * so at most UINT32_MAX values are accepted. */
+    SearchIndex(const int *data, size_t size):
+        data(data), size(size), nblocks(btree_nodes(size)),
+        eytz(nullptr), eytz_pos(nullptr), btree(nullptr), btree_pos(nullptr)
+    {
+        if (size > UINT32_MAX)
+            throw std::length_error("SearchIndex: too many values");
+#ifdef __AVX2__
+        btree_buf.resize(nblocks);
+        btree_pos_buf.resize(btree_pos_size(size));
+        build_btree(data, size, btree_buf.data(), btree_pos_buf.data());
+        btree = btree_buf.data();
+        btree_pos = btree_pos_buf.data();
+#else
+        add_eytzinger();
+#endif
+    }
+
+    /* Uses layouts built beforehand by build_eytzinger() and build_btree();
+     * they must outlive the index */
+    SearchIndex(const int *data, size_t size, const int *eytz, const uint32_t *eytz_pos,
+            const Node *btree, const uint32_t *btree_pos):
+        data(data), size(size), nblocks(btree_nodes(size)),
+        eytz(eytz), eytz_pos(eytz_pos), btree(btree), btree_pos(btree_pos)
+    {
+        if (size > UINT32_MAX)
+            throw std::length_error("SearchIndex: too many values");
+    }
+
+    /* Builds Eytzinger layout if it is not there yet, so that
+     * lower_bound_eytzinger() can be used next to the B-tree kernel */
+    void add_eytzinger()
+    {
+        if (eytz)
+            return;
+        eytz_buf.resize(eytzinger_size(size));
+        eytz_pos_buf.resize(eytzinger_size(size));
+        build_eytzinger(data, size, eytz_buf.data(), eytz_pos_buf.data());
+        eytz = eytz_buf.data();
+        eytz_pos = eytz_pos_buf.data();
+    }
+
+    const int *
+    lower_bound_eytzinger(int x) const
+    {
+        const int *b = eytz;
+        size_t k = 1;
+        while (k <= size) {
+            __builtin_prefetch(b + k * 16);
+            k = 2*k + (b[k] < x);
+        }
+        /* drop trailing ones: the turns right after the answer */
+        k >>= __builtin_ffsll(~k);
+        return data + eytz_pos[k];
+    }
+
+#ifdef __AVX2__
+    const int *
+    lower_bound_btree(int x) const
+    {
+        const __m256i xv = _mm256_set1_epi32(x);
+        size_t k = 0;
+        size_t res = size;
+        while (k < nblocks) {
+            __m256i keys = _mm256_load_si256(reinterpret_cast<const __m256i *>(btree[k].key));
+            __m256i lt = _mm256_cmpgt_epi32(xv, keys);
+            unsigned c = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+            size_t p = btree_pos[k*B + c];
+            res = c < B ? p : res;
+            k = k * (B+1) + c + 1;
+        }
+        return data + res;
+    }
+#endif
+
+    const int *
+    lower_bound(int x) const
+    {
+#ifdef __AVX2__
+        return lower_bound_btree(x);
+#else
+        return lower_bound_eytzinger(x);
+#endif
+    }
+
+    const int *
+    upper_bound(int x) const
+    {
+        if (x == INT_MAX)
+            return data + size;
+        return lower_bound(x + 1);
+    }
+};
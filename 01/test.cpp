@@ -2,46 +2,13 @@
 #include <iostream>
 #include <algorithm>
 #include <vector>
-/* Data, Size */
-#include "numbers.dat"
+#include <string>
+#include "counter.h"
+#include "dataset.h"
 
 
 #define MAX_N 100000
-
-/* Primality test for numbers in range [0, MAX_N] using sieve of Eratosthenes */
-class Primes {
-    int *prime;
-    int n;
-public:
-    Primes(int max_prime)
-    {
-        n = max_prime;
-        prime = new int[n+1];
-        std::fill(prime, &prime[n+1], 1);
-        prime[0] = 0;
-        prime[1] = 0;
-
-        for (int i = 4; i <= n; i += 2)
-            prime[i] = 0;
-        
-        for (int p = 3; p <= n; p += 2)
-            if (prime[p] == 1)
-                for (int i = 2*p; i <= n; i += p)
-                    prime[i] = 0;
-    }
-
-    ~Primes()
-    {
-        delete[] prime;
-    }
-
-    int 
-    operator[](int i) 
-    {
-        /* we could add border check */
-        return prime[i];
-    }
-};
+#define DATASET "numbers.bin"
 
 int 
 parse_args(int argc, char *argv[], std::vector<int> &v)
@@ -61,32 +28,75 @@ parse_args(int argc, char *argv[], std::vector<int> &v)
     return argc-1;
 }
 
+/* pairs from stdin, for batches that do not fit into command line */
+int
+read_pairs(std::FILE *in, std::vector<int> &v)
+{
+    int l, r;
+    int read;
+    while ((read = std::fscanf(in, "%d %d", &l, &r)) == 2) {
+        v.push_back(l);
+        v.push_back(r);
+    }
+    return read == EOF;
+}
+
 int
 main(int argc, char *argv[])
 {
     std::vector<int> v;
-    Primes prime(MAX_N);
+    const char *dataset = DATASET;
 
-    if (!parse_args(argc, argv, v)) {
-        return -1;
+    unsigned threads = 1;
+    bool check = false;
+
+    /* test [-c] [-d dataset] (l r)... | test [-c] [-d dataset] [-j threads] -
+     * -c verifies the dataset checksum, reading the whole file */
+    if (argc > 1 && std::string(argv[1]) == "-c") {
+        check = true;
+        argv[1] = argv[0];
+        --argc;
+        ++argv;
+    }
+    if (argc > 2 && std::string(argv[1]) == "-d") {
+        dataset = argv[2];
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc > 2 && std::string(argv[1]) == "-j") {
+        if (std::sscanf(argv[2], "%u", &threads) != 1 || threads == 0)
+            return -1;
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
     }
+    bool bulk = argc == 2 && std::string(argv[1]) == "-";
 
-    for (int i = 0; i < argc/2; ++i) {
-        int l = v[i*2];
-        int r = v[i*2 + 1];
-        int res = 0;
-        auto beg = std::lower_bound(Data, Data+Size, l);
-        auto end = std::upper_bound(Data, Data+Size, r);
+    if (bulk) {
+        if (!read_pairs(stdin, v))
+            return -1;
+    } else if (!parse_args(argc, argv, v)) {
+        return -1;
+    }
 
-        if (beg == Data+Size || beg[0] != l || l < 0
-              || end == Data || end[-1] != r || r > MAX_N) {
-            std::cout << 0 << std::endl;
-            continue;
-        }
-        
-        for (auto i = beg; i < end; ++i) {
-            res += prime[*i];
+    try {
+        /* tables are mapped from the file, nothing is scanned at startup */
+        Dataset data(dataset, check);
+        PrimeCounter counter(data, MAX_N);
+        if (bulk) {
+            std::vector<int> res;
+            count_parallel(counter, v, res, threads);
+            for (int x : res)
+                std::cout << x << '\n';
+            std::cout.flush();
+        } else {
+            for (size_t i = 0; i < v.size() / 2; ++i)
+                std::cout << counter.count(v[i*2], v[i*2 + 1]) << std::endl;
         }
-        std::cout << res << std::endl;
+    }
+    catch (DatasetError &e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
     }
 }
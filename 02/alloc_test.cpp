@@ -0,0 +1,86 @@
+#include <iostream>
+#include <new>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include "calc.h"
+
+/* Counting allocator: parsing an expression must not touch the heap,
+ * and neither must reporting its error as a status code */
+
+static size_t allocations = 0;
+static int failures = 0;
+
+/* unlike assert, kept with NDEBUG, so the calls under test always run */
+#define check(cond) do { if (!(cond)) { ++failures; std::cerr << "line " << __LINE__ << ": " << #cond << '\n'; } } while(0)
+
+void *
+operator new(size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+int
+main()
+{
+    Variables vars;
+    vars["a"] = 7;
+    vars["long_name"] = -3;
+    std::string owned = "12 * a - long_name / 2 + -a";
+
+    size_t before = allocations;
+    int64_t res = 0;
+
+    check(Calc("2 + 3 * 4").evaluate() == 14);
+    check(Calc(" -9223372036854775808 / 2 ").evaluate() == INT64_MIN / 2);
+    check(Calc(owned, &vars).evaluate() == 12 * 7 - (-3) / 2 - 7);
+    check(Calc("1 - -1").evaluate(res) == CALC_OK && res == 2);
+    check(Calc(std::string_view(owned).substr(0, 6), &vars).evaluate(res) == CALC_OK && res == 84);
+
+    check(allocations == before);
+
+    /* error paths: status codes without exceptions, and lazily built messages */
+    check(Calc("1 / 0").evaluate(res) == CALC_DIVISION_BY_ZERO);
+    check(Calc("-9223372036854775808 / -1").evaluate(res) == CALC_OVERFLOW);
+    check(Calc("01").evaluate(res) == CALC_LEADING_ZEROS);
+    check(Calc("9223372036854775808").evaluate(res) == CALC_OVERFLOW);
+    check(Calc("2 + b", &vars).evaluate(res) == CALC_UNKNOWN_VARIABLE);
+    check(Calc("2 +").evaluate(res) == CALC_BAD_TOKEN);
+    check(Calc("2 % 3").evaluate(res) == CALC_BAD_TOKEN);
+    check(Calc("2 3").evaluate(res) == CALC_BAD_TOKEN);
+
+    check(allocations == before);
+
+    try {
+        Calc("2 3").evaluate();
+        check(false);
+    }
+    catch (Error &e) {
+        check(std::strcmp(e.what(), "BadToken(3): evaluation was stopped on token") == 0);
+    }
+    try {
+        Calc("5 / 0").evaluate();
+        check(false);
+    }
+    catch (Error &e) {
+        check(std::strcmp(e.what(), "Error: division by zero") == 0);
+    }
+
+    return failures ? 1 : 0;
+}
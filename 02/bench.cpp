@@ -0,0 +1,137 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <random>
+
+#include "calc.h"
+
+/* Per-call parse (Calc) against compile-once/eval-many (Program) */
+
+static const char *Expressions[] = {
+    "2 + 3 * 4",
+    "-5 * 7 - 100 / -3 + 12",
+    "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10",
+    "123456789 * 1000 / 7 - 99 * -99 + 42 / 2 * 3",
+    "9223372036854775807 - 1 - 2 - 3",
+};
+
+/* One parametrized expression over columns of variable values */
+int
+bench_columns(size_t rows)
+{
+    const char *expr = "a * 3 + b - c / d * -a";
+    Program program(expr);
+    const std::vector<std::string> &names = program.variables();
+
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<int64_t> dist(-1000, 1000);
+    std::vector<std::vector<int64_t>> data(names.size(), std::vector<int64_t>(rows));
+    std::vector<const int64_t *> columns;
+    for (auto &col : data) {
+        for (auto &x : col)
+            x = dist(gen);
+        columns.push_back(col.data());
+    }
+
+    std::vector<int64_t> out(rows);
+    std::unique_ptr<bool[]> ok(new bool[rows]);
+    auto start = std::chrono::steady_clock::now();
+    program.evaluate_columns(columns.data(), rows, out.data(), ok.get());
+    double col_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Variables vars;
+    start = std::chrono::steady_clock::now();
+    for (size_t row = 0; row < rows; ++row) {
+        for (size_t i = 0; i < names.size(); ++i)
+            vars[names[i]] = data[i][row];
+        bool row_ok = true;
+        int64_t val = 0;
+        try {
+            val = Calc(expr, &vars).evaluate();
+        }
+        catch (Error &e) {
+            row_ok = false;
+        }
+        if (row_ok != ok[row] || (row_ok && val != out[row])) {
+            std::cerr << "mismatch at row " << row << std::endl;
+            return 1;
+        }
+    }
+    double calc_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << '"' << expr << "\" rows=" << rows << "\tcalc_ns\t" << calc_sec * 1e9 / rows
+              << "\tcolumns_ns\t" << col_sec * 1e9 / rows << std::endl;
+    return 0;
+}
+
+static const char *FoldExpressions[] = {
+    "2 * 3 + x",
+    "x * 8 + y * 1 - 0 + 4 / 2 * 10",
+    "60 * 60 * 24 * x / 1 + 0 * y - 1000 * 1000",
+    "x * 0 + y * 16 / 4 + 1 - 1",
+};
+
+/* Nodes removed by Folder and evaluation time with and without it */
+int
+bench_fold(size_t iters)
+{
+    const int64_t values[] = { 12345, -678 };
+
+    std::cout << "expression\tparsed\tresidual\tplain_ns\tfolded_ns" << std::endl;
+    for (const char *expr : FoldExpressions) {
+        Program plain(expr, false);
+        Program folded(expr);
+        int64_t s1 = 0, s2 = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iters; ++i)
+            s1 += plain.evaluate(values);
+        double plain_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iters; ++i)
+            s2 += folded.evaluate(values);
+        double folded_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (s1 != s2 || plain.variables() != folded.variables()) {
+            std::cerr << "mismatch on '" << expr << "'" << std::endl;
+            return 1;
+        }
+        std::cout << '"' << expr << "\"\t" << folded.parsed_size() << '\t' << folded.size() << '\t'
+                  << plain_sec * 1e9 / iters << '\t' << folded_sec * 1e9 / iters << std::endl;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t iters = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    std::cout << "expression\tcalc_ns\tprogram_ns" << std::endl;
+    for (const char *expr : Expressions) {
+        int64_t s1 = 0, s2 = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iters; ++i)
+            s1 += Calc(expr).evaluate();
+        double calc_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        Program program(expr);
+        for (size_t i = 0; i < iters; ++i)
+            s2 += program.evaluate();
+        double prog_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (s1 != s2) {
+            std::cerr << "mismatch on '" << expr << "'" << std::endl;
+            return 1;
+        }
+        std::cout << '"' << expr << "\"\t" << calc_sec * 1e9 / iters << '\t' << prog_sec * 1e9 / iters << std::endl;
+    }
+    if (bench_fold(iters))
+        return 1;
+    return bench_columns(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000);
+}
@@ -0,0 +1,789 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <map>
+#include <functional>
+#include <exception>
+#include <algorithm>
+
+#include <cstdint>
+#include <cctype>
+
+typedef enum {
+    TOKEN_INVALID,
+    TOKEN_NUMBER,
+    TOKEN_VAR,
+    TOKEN_MUL,
+    TOKEN_DIV,
+    TOKEN_PLUS,
+    TOKEN_MIN,
+    TOKEN_END,
+} token_type_t;
+
+struct Token 
+{
+    token_type_t type;
+    int64_t num;
+    /* points into the parsed string */
+    std::string_view name;
+
+    Token(token_type_t t, int64_t n=0): type(t), num(n) { }
+    Token(std::string_view name): type(TOKEN_VAR), num(0), name(name) { }
+
+    std::string repr() const
+    {
+        switch (type) {
+            case TOKEN_INVALID: 
+                return "Invalid";
+            case TOKEN_NUMBER: 
+                return std::to_string(num);
+            case TOKEN_VAR:
+                return std::string(name);
+            case TOKEN_MUL:
+                return "*";
+            case TOKEN_DIV:
+                return "/";
+            case TOKEN_PLUS:
+                return "+";
+            case TOKEN_MIN:
+                return "-";
+            case TOKEN_END:
+                return "End";
+        }
+        return "Broken";
+    }
+};
+
+/* Values of named variables, looked up by std::string or by name inside expression */
+typedef std::map<std::string, int64_t, std::less<>> Variables;
+
+typedef enum {
+    CALC_OK,
+    CALC_ERROR,
+    CALC_BAD_TOKEN,
+    CALC_LEADING_ZEROS,
+    CALC_OVERFLOW,
+    CALC_DIVISION_BY_ZERO,
+    CALC_UNKNOWN_VARIABLE,
+} calc_status_t;
+
+/* Message is built on the first what() call, so throwing and catching
+ * an Error does not allocate strings. BadToken keeps a view into the
+ * parsed string: call what() while that string is alive. */
+class Error: public std::exception
+{
+protected:
+    calc_status_t code;
+    const char *cause;
+    mutable std::string msg;
+
+    virtual void format() const
+    {
+        if (cause) msg = std::string("Error: ") + cause;
+    }
+
+public:
+    Error(const char *cause=NULL, calc_status_t code=CALC_ERROR): code(code), cause(cause) { }
+
+    virtual const char *what() const noexcept
+    {
+        if (msg.empty())
+            format();
+        return msg.c_str();
+    }
+
+    calc_status_t status() const
+    {
+        return code;
+    }
+};
+
+class BadToken: public Error 
+{
+    Token token;
+
+    virtual void format() const
+    {
+        if (cause) {
+            msg = "BadToken(" + token.repr() + "): " + cause;
+        } else {
+            msg = "BadToken(" + token.repr() + ")";
+        }
+    }
+
+public:
+    BadToken(const Token &token, const char *cause=NULL, calc_status_t code=CALC_BAD_TOKEN):
+        Error(cause, code), token(token)
+    { }
+};
+
+
+/* Errors do not throw: get() returns TOKEN_INVALID, status() and reason() describe it */
+class Tokenizer 
+{
+    const char *c;
+    const char *end;
+    const char *cause;
+    calc_status_t code;
+
+    const static int64_t NEGAIVE_OVERFLOW = INT64_MIN / 10;
+    const static int64_t POSITIVE_OVERFLOW = INT64_MAX / 10;
+
+    bool fail(const char *why, calc_status_t status)
+    {
+        cause = why;
+        code = status;
+        return false;
+    }
+
+    token_type_t operation_to_type(char c) 
+    {
+        if (c == '*') 
+            return TOKEN_MUL;
+        if (c == '/')
+            return TOKEN_DIV;
+        if (c == '+')
+            return TOKEN_PLUS;
+        if (c == '-')
+            return TOKEN_MIN;
+        fail("invalid operation", CALC_BAD_TOKEN);
+        return TOKEN_INVALID;
+    }
+
+    bool get_positive(int64_t &n)
+    {
+        n = *c++ - '0';
+        if (c < end && std::isdigit(*c) && n == 0) 
+            return fail("leading zeros", CALC_LEADING_ZEROS);
+        while (c < end && std::isdigit(*c)) {
+            if (n > POSITIVE_OVERFLOW || INT64_MAX - n*10 < *c - '0')
+                return fail("positive overflow", CALC_OVERFLOW);
+            n = n*10 + (*c++ - '0');
+        }
+        return true;
+    }
+    bool get_negative(int64_t &n) 
+    {
+        n = -(*c++ - '0');
+        if (c < end && std::isdigit(*c) && n == 0) 
+            return fail("leading zeros", CALC_LEADING_ZEROS);
+        while (c < end && std::isdigit(*c)) {
+            if (n < NEGAIVE_OVERFLOW || n*10 - INT64_MIN < *c - '0')
+                return fail("negative overflow", CALC_OVERFLOW);
+            n = n*10 - (*c++ - '0');
+        }
+        return true;
+    }
+
+    static bool is_name_start(char c)
+    {
+        return std::isalpha(c) || c == '_';
+    }
+
+    std::string_view get_name()
+    {
+        const char *beg = c++;
+        while (c < end && (std::isalnum(*c) || *c == '_'))
+            ++c;
+        return std::string_view(beg, c - beg);
+    }
+
+    Tokenizer(const Tokenizer &tok); 
+    Tokenizer(const Tokenizer &&tok);
+    Tokenizer &operator=(const Tokenizer &tok);
+    Tokenizer &operator=(const Tokenizer &&tok);
+public:
+    Tokenizer(std::string_view str):
+        c(str.data()), end(str.data() + str.size()), cause(NULL), code(CALC_OK)
+    { }
+
+    Token get(bool negative=false) 
+    {
+        while (c < end && std::isspace(*c))
+            ++c;
+        
+        if (c == end)
+            return Token(TOKEN_END);
+        
+        if (std::isdigit(*c)) {
+            int64_t n;
+            if (negative ? get_negative(n) : get_positive(n))
+                return Token(TOKEN_NUMBER, n);
+            return Token(TOKEN_INVALID);
+        }
+        if (is_name_start(*c))
+            return Token(get_name());
+        return Token(operation_to_type(*c++));
+    }
+
+    calc_status_t status() const
+    {
+        return code;
+    }
+
+    const char *reason() const
+    {
+        return cause;
+    }
+};
+
+/* Evaluates while parsing. Failures are returned as status codes down
+ * the recursion, so evaluate(int64_t &) never throws; the first one is
+ * kept to build the exception thrown by evaluate(). */
+class Calc 
+{
+    Tokenizer tokenizer;
+    Token token;
+    const Variables *vars;
+    calc_status_t code;
+    const char *cause;
+    /* token for BadToken, TOKEN_INVALID for plain Error */
+    Token bad;
+
+    bool fail(const char *why, calc_status_t status)
+    {
+        cause = why;
+        code = status;
+        return false;
+    }
+
+    bool fail(const Token &t, const char *why, calc_status_t status=CALC_BAD_TOKEN)
+    {
+        bad = t;
+        return fail(why, status);
+    }
+
+    bool next(Token &t, bool negative=false)
+    {
+        t = tokenizer.get(negative);
+        if (t.type != TOKEN_INVALID)
+            return true;
+        return fail(tokenizer.reason(), tokenizer.status());
+    }
+
+    bool get_number(int64_t &val) 
+    {
+        Token t(TOKEN_INVALID);
+        if (!next(t))
+            return false;
+        bool negative = t.type == TOKEN_MIN;
+        if (negative && !next(t, true))
+            return false;
+        if (t.type == TOKEN_NUMBER) {
+            val = t.num;
+            return true;
+        }
+        if (t.type == TOKEN_VAR) {
+            if (!vars)
+                return fail(t, "unknown variable", CALC_UNKNOWN_VARIABLE);
+            auto it = vars->find(t.name);
+            if (it == vars->end())
+                return fail(t, "unknown variable", CALC_UNKNOWN_VARIABLE);
+            val = negative ? -it->second : it->second;
+            return true;
+        }
+        return fail(t, "expect number");
+    }
+
+    bool l1_eval(int64_t &val) 
+    {
+        if (!l2_eval(val))
+            return false;
+        while (true) {
+            int64_t rhs;
+            switch (token.type) {
+                case TOKEN_PLUS:
+                    if (!l2_eval(rhs))
+                        return false;
+                    val += rhs;
+                    break;
+                case TOKEN_MIN:
+                    if (!l2_eval(rhs))
+                        return false;
+                    val -= rhs;
+                    break;
+                default:
+                    return true;
+            }
+        }
+    }
+
+    bool l2_eval(int64_t &val)
+    {
+        if (!get_number(val))
+            return false;
+        while (true) {
+            if (!next(token))
+                return false;
+            int64_t d;
+            switch (token.type) {
+                case TOKEN_MUL:
+                    if (!get_number(d))
+                        return false;
+                    val *= d;
+                    break;
+                case TOKEN_DIV:
+                    if (!get_number(d))
+                        return false;
+                    if (d == 0)
+                        return fail("division by zero", CALC_DIVISION_BY_ZERO);
+                    if (val == INT64_MIN && d == -1)
+                        return fail("division overflow", CALC_OVERFLOW);
+                    val /= d;
+                    break;
+                default:
+                    return true;
+            }
+        }
+    }
+
+public:
+    Calc(std::string_view s, const Variables *vars=NULL):
+        tokenizer(s), token(TOKEN_INVALID), vars(vars), code(CALC_OK), cause(NULL), bad(TOKEN_INVALID)
+    { }
+
+    int64_t evaluate()
+    {
+        int64_t val = 0;
+        if (evaluate(val) == CALC_OK)
+            return val;
+        if (bad.type != TOKEN_INVALID)
+            throw BadToken(bad, cause, code);
+        throw Error(cause, code);
+    }
+
+    /* Same as evaluate(), but reports failure with status code */
+    calc_status_t evaluate(int64_t &res) noexcept
+    {
+        if (!l1_eval(res))
+            return code;
+        if (token.type != TOKEN_END) {
+            fail(token, "evaluation was stopped on token");
+            return code;
+        }
+        return CALC_OK;
+    }
+};
+
+typedef enum {
+    OP_PUSH,
+    OP_VAR,
+    OP_NVAR,
+    OP_MUL,
+    OP_DIV,
+    OP_PLUS,
+    OP_MIN,
+    /* multiplication by 1 << num */
+    OP_SHL,
+} opcode_t;
+
+struct Instruction
+{
+    opcode_t op;
+    int64_t num;
+
+    Instruction(opcode_t op, int64_t num=0): op(op), num(num) { }
+};
+
+/* Expression tree built by the parser, node 0 is the root.
+ * Leaves are OP_PUSH, OP_VAR and OP_NVAR nodes, OP_SHL has only left child. */
+struct AstNode
+{
+    opcode_t op;
+    int64_t num;
+    int left;
+    int right;
+};
+
+/* Constant folding and strength reduction over the tree.
+ * Only rewrites that keep Calc results and errors are done: constants are
+ * folded when the operation does not overflow and is not a division by zero,
+ * x * 0 becomes 0 only when x has no division that could fail. Operands are
+ * not reassociated, so x + 2 + 3 stays as it is. */
+class Folder
+{
+    std::vector<AstNode> &nodes;
+
+    bool is_const(int n, int64_t v) const
+    {
+        return nodes[n].op == OP_PUSH && nodes[n].num == v;
+    }
+
+    bool may_fail(int n) const
+    {
+        const AstNode &node = nodes[n];
+        switch (node.op) {
+            case OP_PUSH:
+            case OP_VAR:
+            case OP_NVAR:
+                return false;
+            case OP_DIV:
+                return true;
+            case OP_SHL:
+                return may_fail(node.left);
+            default:
+                return may_fail(node.left) || may_fail(node.right);
+        }
+    }
+
+    static int log2(int64_t x)
+    {
+        if (x < 2 || (x & (x - 1)))
+            return -1;
+        return __builtin_ctzll(x);
+    }
+
+    void make_const(int n, int64_t v)
+    {
+        nodes[n] = AstNode { OP_PUSH, v, -1, -1 };
+    }
+
+    void make_shl(int n, int child, int k)
+    {
+        nodes[n] = AstNode { OP_SHL, k, child, -1 };
+    }
+
+    bool fold_consts(int n)
+    {
+        AstNode &node = nodes[n];
+        if (node.op == OP_SHL || nodes[node.left].op != OP_PUSH || nodes[node.right].op != OP_PUSH)
+            return false;
+        int64_t a = nodes[node.left].num;
+        int64_t b = nodes[node.right].num;
+        int64_t r;
+        bool overflow;
+        switch (node.op) {
+            case OP_PLUS:
+                overflow = __builtin_add_overflow(a, b, &r);
+                break;
+            case OP_MIN:
+                overflow = __builtin_sub_overflow(a, b, &r);
+                break;
+            case OP_MUL:
+                overflow = __builtin_mul_overflow(a, b, &r);
+                break;
+            case OP_DIV:
+                overflow = b == 0 || (a == INT64_MIN && b == -1);
+                r = overflow ? 0 : a / b;
+                break;
+            default:
+                return false;
+        }
+        if (!overflow)
+            make_const(n, r);
+        return !overflow;
+    }
+
+public:
+    Folder(std::vector<AstNode> &nodes): nodes(nodes) { }
+
+    void fold(int n)
+    {
+        AstNode node = nodes[n];
+        if (node.left < 0)
+            return;
+        fold(node.left);
+        if (node.right >= 0)
+            fold(node.right);
+        if (fold_consts(n))
+            return;
+
+        int l = node.left;
+        int r = node.right;
+        int k;
+        switch (node.op) {
+            case OP_PLUS:
+                if (is_const(r, 0))
+                    nodes[n] = nodes[l];
+                else if (is_const(l, 0))
+                    nodes[n] = nodes[r];
+                break;
+            case OP_MIN:
+                if (is_const(r, 0))
+                    nodes[n] = nodes[l];
+                break;
+            case OP_MUL:
+                if (is_const(r, 1))
+                    nodes[n] = nodes[l];
+                else if (is_const(l, 1))
+                    nodes[n] = nodes[r];
+                else if ((is_const(r, 0) && !may_fail(l)) || (is_const(l, 0) && !may_fail(r)))
+                    make_const(n, 0);
+                else if (nodes[r].op == OP_PUSH && (k = log2(nodes[r].num)) > 0)
+                    make_shl(n, l, k);
+                else if (nodes[l].op == OP_PUSH && (k = log2(nodes[l].num)) > 0)
+                    make_shl(n, r, k);
+                break;
+            case OP_DIV:
+                if (is_const(r, 1))
+                    nodes[n] = nodes[l];
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+/* Expression compiled once into postfix bytecode and evaluated many times.
+ * Parsing follows Calc, so overflow and leading zeros are reported by the
+ * constructor, division by zero and INT64_MIN / -1 by evaluate(). The
+ * parsed tree goes through Folder unless optimization is turned off.
+ * Variables get slots in order of first appearance, see variables(). */
+class Program
+{
+    /* value, product being built and its next factor */
+    static constexpr size_t STACK_SIZE = 3;
+    /* rows evaluated together by evaluate_columns() */
+    static constexpr size_t BLOCK = 256;
+
+    std::vector<Instruction> code;
+    std::vector<std::string> names;
+    size_t parsed;
+
+    class Parser
+    {
+        Tokenizer tokenizer;
+        Token token;
+        std::vector<AstNode> &nodes;
+        std::vector<std::string> &names;
+
+        int64_t slot(std::string_view name)
+        {
+            for (size_t i = 0; i < names.size(); ++i)
+                if (names[i] == name)
+                    return i;
+            names.push_back(std::string(name));
+            return names.size() - 1;
+        }
+
+        int node(opcode_t op, int64_t num, int left=-1, int right=-1)
+        {
+            nodes.push_back(AstNode { op, num, left, right });
+            return nodes.size() - 1;
+        }
+
+        Token next(bool negative=false)
+        {
+            Token t = tokenizer.get(negative);
+            if (t.type == TOKEN_INVALID)
+                throw Error(tokenizer.reason(), tokenizer.status());
+            return t;
+        }
+
+        int get_number()
+        {
+            Token t = next();
+            bool negative = t.type == TOKEN_MIN;
+            if (negative)
+                t = next(true);
+            if (t.type == TOKEN_NUMBER)
+                return node(OP_PUSH, t.num);
+            if (t.type == TOKEN_VAR)
+                return node(negative ? OP_NVAR : OP_VAR, slot(t.name));
+            throw BadToken(t, "expect number");
+        }
+
+        int l1_parse()
+        {
+            int val = l2_parse();
+            while (token.type == TOKEN_PLUS || token.type == TOKEN_MIN) {
+                opcode_t op = token.type == TOKEN_PLUS ? OP_PLUS : OP_MIN;
+                val = node(op, 0, val, l2_parse());
+            }
+            return val;
+        }
+
+        int l2_parse()
+        {
+            int val = get_number();
+            while (true) {
+                token = next();
+                if (token.type != TOKEN_MUL && token.type != TOKEN_DIV)
+                    return val;
+                opcode_t op = token.type == TOKEN_MUL ? OP_MUL : OP_DIV;
+                val = node(op, 0, val, get_number());
+            }
+        }
+
+    public:
+        Parser(std::string_view s, std::vector<AstNode> &nodes, std::vector<std::string> &names):
+            tokenizer(s), token(TOKEN_INVALID), nodes(nodes), names(names)
+        { }
+
+        /* returns root */
+        int parse()
+        {
+            int root = l1_parse();
+            if (token.type != TOKEN_END)
+                throw BadToken(token, "evaluation was stopped on token");
+            return root;
+        }
+    };
+
+    /* post-order walk, returns stack depth needed for the subtree */
+    size_t emit(const std::vector<AstNode> &nodes, int n)
+    {
+        const AstNode &node = nodes[n];
+        size_t depth = 1;
+        if (node.left >= 0)
+            depth = emit(nodes, node.left);
+        if (node.right >= 0)
+            depth = std::max(depth, 1 + emit(nodes, node.right));
+        code.push_back(Instruction(node.op, node.num));
+        return depth;
+    }
+
+public:
+    Program(std::string_view s, bool optimize=true)
+    {
+        std::vector<AstNode> nodes;
+        int root = Parser(s, nodes, names).parse();
+        parsed = nodes.size();
+        if (optimize)
+            Folder(nodes).fold(root);
+        if (emit(nodes, root) > STACK_SIZE)
+            throw Error("expression is too deep");
+    }
+
+    /* values[i] is the value of variables()[i] */
+    int64_t evaluate(const int64_t *values=NULL) const
+    {
+        if (!values && !names.empty())
+            throw Error("unknown variable", CALC_UNKNOWN_VARIABLE);
+        int64_t stack[STACK_SIZE];
+        int64_t *top = stack;
+        for (const Instruction &i : code) {
+            switch (i.op) {
+                case OP_PUSH:
+                    *top++ = i.num;
+                    break;
+                case OP_VAR:
+                    *top++ = values[i.num];
+                    break;
+                case OP_NVAR:
+                    *top++ = -values[i.num];
+                    break;
+                case OP_MUL:
+                    --top;
+                    top[-1] *= top[0];
+                    break;
+                case OP_DIV:
+                    --top;
+                    if (top[0] == 0)
+                        throw Error("division by zero", CALC_DIVISION_BY_ZERO);
+                    if (top[-1] == INT64_MIN && top[0] == -1)
+                        throw Error("division overflow", CALC_OVERFLOW);
+                    top[-1] /= top[0];
+                    break;
+                case OP_PLUS:
+                    --top;
+                    top[-1] += top[0];
+                    break;
+                case OP_MIN:
+                    --top;
+                    top[-1] -= top[0];
+                    break;
+                case OP_SHL:
+                    top[-1] = uint64_t(top[-1]) << i.num;
+                    break;
+            }
+        }
+        return stack[0];
+    }
+
+    int64_t evaluate(const Variables &vars) const
+    {
+        std::vector<int64_t> values(names.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            auto it = vars.find(names[i]);
+            if (it == vars.end())
+                throw Error("unknown variable", CALC_UNKNOWN_VARIABLE);
+            values[i] = it->second;
+        }
+        return evaluate(values.data());
+    }
+
+    /* Evaluates expression for every row: columns[i][row] is the value of
+     * variables()[i]. Instructions run over blocks of rows, so every
+     * operation is a plain loop over arrays. Rows where evaluate() would
+     * throw, on division by zero or INT64_MIN / -1, get ok[row] = false,
+     * the others get out[row] equal to evaluate(). Failed rows are still
+     * computed, so arithmetic wraps instead of overflowing on them. */
+    void evaluate_columns(const int64_t *const *columns, size_t rows, int64_t *out, bool *ok) const
+    {
+        int64_t stack[STACK_SIZE][BLOCK];
+        for (size_t beg = 0; beg < rows; beg += BLOCK) {
+            size_t n = std::min(BLOCK, rows - beg);
+            bool *row_ok = ok + beg;
+            std::fill(row_ok, row_ok + n, true);
+            size_t top = 0;
+            for (const Instruction &i : code) {
+                if (i.op == OP_SHL) {
+                    int64_t *a = stack[top-1];
+                    for (size_t k = 0; k < n; ++k)
+                        a[k] = uint64_t(a[k]) << i.num;
+                    continue;
+                }
+                if (i.op == OP_PUSH || i.op == OP_VAR || i.op == OP_NVAR) {
+                    int64_t *r = stack[top++];
+                    if (i.op == OP_PUSH) {
+                        std::fill(r, r + n, i.num);
+                        continue;
+                    }
+                    const int64_t *v = columns[i.num] + beg;
+                    if (i.op == OP_VAR)
+                        std::copy(v, v + n, r);
+                    else
+                        for (size_t k = 0; k < n; ++k)
+                            r[k] = -uint64_t(v[k]);
+                    continue;
+                }
+                const int64_t *b = stack[--top];
+                int64_t *a = stack[top-1];
+                switch (i.op) {
+                    case OP_MUL:
+                        for (size_t k = 0; k < n; ++k)
+                            a[k] = uint64_t(a[k]) * uint64_t(b[k]);
+                        break;
+                    case OP_DIV:
+                        for (size_t k = 0; k < n; ++k) {
+                            bool good = b[k] != 0 && !(a[k] == INT64_MIN && b[k] == -1);
+                            row_ok[k] &= good;
+                            a[k] /= good ? b[k] : 1;
+                        }
+                        break;
+                    case OP_PLUS:
+                        for (size_t k = 0; k < n; ++k)
+                            a[k] = uint64_t(a[k]) + uint64_t(b[k]);
+                        break;
+                    case OP_MIN:
+                        for (size_t k = 0; k < n; ++k)
+                            a[k] = uint64_t(a[k]) - uint64_t(b[k]);
+                        break;
+                    default:
+                        break;
+                }
+            }
+            std::copy(stack[0], stack[0] + n, out + beg);
+        }
+    }
+
+    const std::vector<std::string> &variables() const
+    {
+        return names;
+    }
+
+    /* number of tree nodes before and after folding */
+    size_t parsed_size() const
+    {
+        return parsed;
+    }
+
+    size_t size() const
+    {
+        return code.size();
+    }
+};
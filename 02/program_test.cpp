@@ -0,0 +1,155 @@
+#include <iostream>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+#include "calc.h"
+
+/* Program must give the same value or the same status as Calc */
+
+static int failures = 0;
+
+/* unlike assert, kept with NDEBUG, so the calls under test always run */
+#define check(cond) do { if (!(cond)) { ++failures; std::cerr << "line " << __LINE__ << ": " << #cond << '\n'; } } while(0)
+
+static calc_status_t
+run_program(std::string_view s, int64_t &res, bool optimize, const Variables *vars=NULL)
+{
+    try {
+        Program program(s, optimize);
+        res = vars ? program.evaluate(*vars) : program.evaluate();
+        return CALC_OK;
+    }
+    catch (Error &e) {
+        return e.status();
+    }
+}
+
+/* both plain and folded programs agree with Calc */
+static bool
+same_as_calc(std::string_view s, const Variables *vars=NULL)
+{
+    int64_t expected = 0;
+    calc_status_t status = Calc(s, vars).evaluate(expected);
+    for (bool optimize : { false, true }) {
+        int64_t res = 0;
+        if (run_program(s, res, optimize, vars) != status)
+            return false;
+        if (status == CALC_OK && res != expected)
+            return false;
+    }
+    return true;
+}
+
+int
+main()
+{
+    check(same_as_calc("2 + 3 * 4 - 10 / 3"));
+    check(same_as_calc("-7 / 2 - -7 / -2"));
+    check(same_as_calc("-9223372036854775808"));
+    check(same_as_calc("9223372036854775807 / -1"));
+
+    /* tokenizer errors are reported by the constructor */
+    check(same_as_calc("01 + 1"));
+    check(same_as_calc("1 - -00"));
+    check(same_as_calc("9223372036854775808"));
+    check(same_as_calc("-9223372036854775809"));
+    check(same_as_calc("2 % 3"));
+
+    /* parser errors */
+    check(same_as_calc(""));
+    check(same_as_calc("2 +"));
+    check(same_as_calc("2 3"));
+    check(same_as_calc("* 2"));
+    check(same_as_calc("1 + x"));
+
+    /* errors found by evaluate() */
+    check(same_as_calc("1 / 0"));
+    check(same_as_calc("1 + 4 / 0 * 3"));
+    check(same_as_calc("-9223372036854775808 / -1"));
+    check(same_as_calc("-9223372036854775808 / -1 + 1"));
+    check(same_as_calc("-9223372036854775808 / 1 / -1"));
+
+    int64_t res = 0;
+    check(run_program("-9223372036854775808 / -1", res, true) == CALC_OVERFLOW);
+    check(run_program("1 / 0", res, true) == CALC_DIVISION_BY_ZERO);
+    check(run_program("1 / 0", res, false) == CALC_DIVISION_BY_ZERO);
+
+    Variables vars;
+    vars["a"] = 7;
+    vars["b"] = -3;
+    vars["zero"] = 0;
+    vars["min"] = INT64_MIN;
+    check(same_as_calc("a * b - -a / b + a", &vars));
+    check(same_as_calc("-b * 2 - b", &vars));
+    check(same_as_calc("a / zero", &vars));
+    check(same_as_calc("min / -1", &vars));
+    check(same_as_calc("min / -zero", &vars));
+    check(same_as_calc("a + c", &vars));
+    check(same_as_calc("a + -c", &vars));
+
+    /* folding keeps errors: x * 0 is not folded over a division */
+    check(same_as_calc("5 / 0 * 0"));
+    check(same_as_calc("0 * a / zero", &vars));
+    check(same_as_calc("a / zero * 0 + 1", &vars));
+    check(same_as_calc("min / -1 * 0", &vars));
+    check(same_as_calc("a * 0 / 0", &vars));
+    check(same_as_calc("-a * 0 + 9223372036854775807 + 0", &vars));
+    check(Program("a * 0 + b").size() == 1);
+    check(Program("a / b * 0").size() == 5);
+
+    /* multiplication by power of two becomes a shift, also for negative x */
+    vars["neg"] = -(int64_t(1) << 60) - 3;
+    check(same_as_calc("b * 8", &vars));
+    check(same_as_calc("4 * -a", &vars));
+    check(same_as_calc("neg * 4", &vars));
+    check(same_as_calc("neg * 2 * 2 - b * 1024", &vars));
+    check(same_as_calc("min * 1 / 2 * 2", &vars));
+    check(Program("a * 8").size() == 2);
+    check(Program("a * 8").parsed_size() == 3);
+
+    /* constants fold unless that would hide an error */
+    check(Program("2 * 3 + 4 / 2 - 1").size() == 1);
+    check(Program("4 / 0 + 1").size() == 5);
+    check(same_as_calc("-9223372036854775808 / -1 * 0"));
+    check(same_as_calc("9223372036854775807 - 7 * 2 / 7"));
+
+    Program program("b * a - b / a + -b");
+    check(program.variables().size() == 2);
+    check(program.variables()[0] == "b" && program.variables()[1] == "a");
+    int64_t values[] = { -3, 7 };
+    check(program.evaluate(values) == program.evaluate(vars));
+    check(run_program("b * a", res, true) == CALC_UNKNOWN_VARIABLE);
+
+    /* columns cross a block boundary, some rows fail */
+    Program columnar("c / b + a * b - a");
+    size_t rows = 1000;
+    std::vector<int64_t> a(rows), b(rows), c(rows), out(rows);
+    std::unique_ptr<bool[]> ok(new bool[rows]);
+    for (size_t row = 0; row < rows; ++row) {
+        a[row] = row;
+        b[row] = int64_t(row % 4) - 1;
+        c[row] = row % 5 ? int64_t(row * 3) : INT64_MIN;
+    }
+    std::vector<const int64_t *> columns;
+    for (const std::string &name : columnar.variables())
+        columns.push_back(name == "a" ? a.data() : name == "b" ? b.data() : c.data());
+    columnar.evaluate_columns(columns.data(), rows, out.data(), ok.get());
+    size_t failed = 0;
+    for (size_t row = 0; row < rows; ++row) {
+        int64_t values[3];
+        for (size_t i = 0; i < 3; ++i)
+            values[i] = columns[i][row];
+        try {
+            int64_t expected = columnar.evaluate(values);
+            check(ok[row] && out[row] == expected);
+        }
+        catch (Error &e) {
+            check(!ok[row]);
+            ++failed;
+        }
+    }
+    check(failed > rows / 4);
+
+    return failures ? 1 : 0;
+}
@@ -1,219 +1,198 @@
 #include <iostream>
-#include <vector>
 #include <string>
-#include <exception>
-
-#include <cstdint>
-#include <cctype>
-
-typedef enum {
-    TOKEN_INVALID,
-    TOKEN_NUMBER,
-    TOKEN_MUL,
-    TOKEN_DIV,
-    TOKEN_PLUS,
-    TOKEN_MIN,
-    TOKEN_END,
-} token_type_t;
-
-struct Token 
-{
-    token_type_t type;
-    int64_t num;
+#include <string_view>
+#include <vector>
+#include <thread>
+
+#include <cstdio>
 
-    Token(token_type_t t, int64_t n=0): type(t), num(n) { }
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-    std::string repr() const
+#include "calc.h"
+
+/* Read-only mapping of the whole file */
+class FileMapping {
+    int fd;
+    size_t size;
+    void *ptr;
+
+    FileMapping(const FileMapping &);
+    FileMapping &operator=(const FileMapping &);
+public:
+    FileMapping(const char *filename): size(0), ptr(MAP_FAILED)
     {
-        switch (type) {
-            case TOKEN_INVALID: 
-                return "Invalid";
-            case TOKEN_NUMBER: 
-                return std::to_string(num);
-            case TOKEN_MUL:
-                return "*";
-            case TOKEN_DIV:
-                return "/";
-            case TOKEN_PLUS:
-                return "+";
-            case TOKEN_MIN:
-                return "-";
-            case TOKEN_END:
-                return "End";
+        fd = open(filename, O_RDONLY);
+        if (fd == -1)
+            throw Error("can't open file");
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            throw Error("can't stat file");
+        }
+        size = st.st_size;
+        if (size) {
+            ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED) {
+                close(fd);
+                throw Error("can't mmap file");
+            }
         }
-        return "Broken";
     }
-};
-
-class Error: public std::exception
-{
-protected:
-    std::string msg;
 
-public:
-    Error(const char *cause=NULL)
+    ~FileMapping()
     {
-        if (cause) msg = std::string("Error: ") + cause;
+        if (ptr != MAP_FAILED)
+            munmap(ptr, size);
+        close(fd);
     }
-    virtual const char *what() const noexcept
+
+    std::string_view view() const
     {
-        return msg.c_str();
+        if (!size)
+            return std::string_view();
+        return std::string_view(static_cast<const char *>(ptr), size);
     }
 };
 
-class BadToken: public Error 
+std::vector<std::string_view>
+split_lines(std::string_view text)
 {
-public:
-    BadToken(const Token &token, const char *cause=NULL) 
-    { 
-        if (cause) {
-            msg = "BadToken(" + token.repr() + "): " + cause;
-        } else {
-            msg = "BadToken(" + token.repr() + ")";
-        }
+    std::vector<std::string_view> lines;
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        if (end == std::string_view::npos)
+            end = text.size();
+        lines.push_back(text.substr(0, end));
+        text.remove_prefix(std::min(end + 1, text.size()));
     }
-};
-
+    return lines;
+}
 
-class Tokenizer 
+/* Lines are split into contiguous chunks, one per thread;
+ * results keep input order. */
+void
+evaluate_lines(const std::vector<std::string_view> &lines, std::vector<int64_t> &res,
+        std::vector<calc_status_t> &status, unsigned threads)
 {
-    const std::string s;
-    std::string::const_iterator c;
+    size_t n = lines.size();
+    res.resize(n);
+    status.resize(n);
+
+    auto work = [&](size_t beg, size_t end) {
+        for (size_t i = beg; i < end; ++i)
+            status[i] = Calc(lines[i]).evaluate(res[i]);
+    };
+
+    std::vector<std::thread> pool;
+    size_t chunk = (n + threads - 1) / threads;
+    for (unsigned t = 1; t < threads && t * chunk < n; ++t)
+        pool.emplace_back(work, t * chunk, std::min(n, (t + 1) * chunk));
+    work(0, std::min(n, chunk));
+    for (auto &t : pool)
+        t.join();
+}
 
-    const static int64_t NEGAIVE_OVERFLOW = INT64_MIN / 10;
-    const static int64_t POSITIVE_OVERFLOW = INT64_MAX / 10;
+/* input bytes evaluated together; a block ends at a line end, so lines
+ * longer than this make it longer */
+static const size_t STREAM_BLOCK = 1 << 20;
 
-    token_type_t operation_to_type(char c) 
-    {
-        if (c == '*') 
-            return TOKEN_MUL;
-        if (c == '/')
-            return TOKEN_DIV;
-        if (c == '+')
-            return TOKEN_PLUS;
-        if (c == '-')
-            return TOKEN_MIN;
-        throw Error("invalid operation");
+/* evaluates whole lines of text and writes results in input order */
+void
+stream_block(std::string_view text, unsigned threads)
+{
+    std::vector<std::string_view> lines = split_lines(text);
+    std::vector<int64_t> res;
+    std::vector<calc_status_t> status;
+    evaluate_lines(lines, res, status, threads);
+
+    std::string out;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (status[i] == CALC_OK)
+            out += std::to_string(res[i]);
+        else
+            out += "error";
+        out += '\n';
     }
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+}
 
-    int64_t get_positive()
-    {
-        int64_t n = *c++ - '0';
-        if (c < s.end() && std::isdigit(*c) && n == 0) 
-            throw Error("leading zeros");
-        while (c < s.end() && std::isdigit(*c)) {
-            if (n > POSITIVE_OVERFLOW || INT64_MAX - n*10 < *c - '0')
-                throw Error("positive overflow");
-            n = n*10 + *c++ - '0';
-        }
-        return n;
-    }
-    int64_t get_negative() 
-    {
-        int64_t n = -(*c++ - '0');
-        if (c < s.end() && std::isdigit(*c) && n == 0) 
-            throw Error("leading zeros");
-        while (c < s.end() && std::isdigit(*c)) {
-            if (n < NEGAIVE_OVERFLOW || n*10 - INT64_MIN < *c - '0')
-                throw Error("negative overflow");
-            n = n*10 - (*c++ - '0');
-        }
-        return n;
-    }
+/* length of the first block of text: STREAM_BLOCK bytes extended to
+ * the end of the line */
+size_t
+block_size(std::string_view text)
+{
+    if (text.size() <= STREAM_BLOCK)
+        return text.size();
+    size_t end = text.find('\n', STREAM_BLOCK - 1);
+    return end == std::string_view::npos ? text.size() : end + 1;
+}
 
-    Tokenizer(const Tokenizer &tok); 
-    Tokenizer(const Tokenizer &&tok);
-    Tokenizer &operator=(const Tokenizer &tok);
-    Tokenizer &operator=(const Tokenizer &&tok);
-public:
-    Tokenizer(const char *str): s(str), c(s.begin()) { }
-    Token get(bool negative=false) 
-    {
-        while (c < s.end() && std::isspace(*c))
-            ++c;
-        
-        if (c == s.end())
-            return Token(TOKEN_END);
-        
-        if (std::isdigit(*c)) {
-            if (negative) {
-                return Token(TOKEN_NUMBER, get_negative());
-            } else {
-                return Token(TOKEN_NUMBER, get_positive());
-            }
-        }
-        return Token(operation_to_type(*c++));
+int
+stream(std::string_view text, unsigned threads)
+{
+    while (!text.empty()) {
+        size_t n = block_size(text);
+        stream_block(text.substr(0, n), threads);
+        text.remove_prefix(n);
     }
-};
+    return 0;
+}
 
-class Calc 
+/* reads blocks while earlier ones are written, so memory and latency
+ * do not grow with the input */
+int
+stream(std::FILE *in, unsigned threads)
 {
-    Tokenizer tokenizer;
-    Token token;
-
-    int64_t get_number() 
-    {
-        Token t = tokenizer.get();
-        if (t.type == TOKEN_MIN)
-            t = tokenizer.get(true);
-        if (t.type == TOKEN_NUMBER)
-            return t.num;
-        throw BadToken(t, "expect number");
-    }
+    std::string buf;
+    size_t got;
+    do {
+        size_t old = buf.size();
+        buf.resize(old + STREAM_BLOCK);
+        got = std::fread(&buf[old], 1, STREAM_BLOCK, in);
+        buf.resize(old + got);
+        size_t end = buf.rfind('\n');
+        if (got && end == std::string::npos)
+            continue;
+        size_t n = got ? end + 1 : buf.size();
+        stream_block(std::string_view(buf).substr(0, n), threads);
+        buf.erase(0, n);
+    } while (got);
+    return std::ferror(in) ? 1 : 0;
+}
 
-    int64_t l1_eval() 
-    {
-        int64_t val = l2_eval();
-        while (true) {
-            switch (token.type) {
-                case TOKEN_PLUS:
-                    val += l2_eval();
-                    break;
-                case TOKEN_MIN:
-                    val -= l2_eval();
-                    break;
-                default:
-                    return val;
-            }
+/* test expr | test [-j threads] - | test [-j threads] -f file */
+int
+main(int argc, char *argv[])
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 2 && std::string(argv[1]) == "-j") {
+        if (std::sscanf(argv[2], "%u", &threads) != 1 || threads == 0) {
+            std::cout << "error" << std::endl;
+            return 1;
         }
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
     }
 
-    int64_t l2_eval()
-    {
-        int64_t val = get_number();
-        while (true) {
-            token = tokenizer.get();
-            switch (token.type) {
-                case TOKEN_MUL:
-                    val *= get_number();
-                    break;
-                case TOKEN_DIV:
-                    if (int64_t d = get_number())
-                        val /= d;
-                    else
-                        throw Error("division by zero");
-                    break;
-                default:
-                    return val;
-            }
+    try {
+        if (argc == 2 && std::string(argv[1]) == "-") {
+            return stream(stdin, threads);
+        }
+        if (argc == 3 && std::string(argv[1]) == "-f") {
+            FileMapping file(argv[2]);
+            return stream(file.view(), threads);
         }
     }
-
-public:
-    Calc(const char *s): tokenizer(s), token(TOKEN_INVALID) { }
-
-    int64_t evaluate()
-    {
-        int64_t val = l1_eval();
-        if (token.type != TOKEN_END)
-            throw BadToken(token, "evaluation was stopped on token");
-        return val;
+    catch (Error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
-};
 
-int
-main(int argc, char *argv[])
-{
     if (argc != 2) {
         std::cout << "error" << std::endl;
         return 1;
@@ -0,0 +1,310 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "matrix.h"
+#include "sparse.h"
+#include "matrix_file.h"
+
+/* GFLOPS of Matrix * Matrix against triple loop through operator[] */
+
+void
+fill(Matrix &m, std::mt19937 &gen)
+{
+    std::uniform_real_distribution<double> dist(-1, 1);
+    for (size_t i = 0; i < m.getRows(); ++i)
+        for (size_t j = 0; j < m.getColumns(); ++j)
+            m[i][j] = dist(gen);
+}
+
+void
+naive_multiply(Matrix &c, const Matrix &a, const Matrix &b)
+{
+    for (size_t i = 0; i < a.getRows(); ++i)
+        for (size_t j = 0; j < b.getColumns(); ++j) {
+            double sum = 0;
+            for (size_t k = 0; k < a.getColumns(); ++k)
+                sum += a[i][k] * b[k][j];
+            c[i][j] = sum;
+        }
+}
+
+double
+max_diff(const Matrix &x, const Matrix &y)
+{
+    double d = 0;
+    for (size_t i = 0; i < x.getRows(); ++i)
+        for (size_t j = 0; j < x.getColumns(); ++j)
+            d = std::max(d, std::fabs(x[i][j] - y[i][j]));
+    return d;
+}
+
+template <class F>
+double
+seconds(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int
+bench_gemm(size_t max_size, size_t max_naive)
+{
+    std::mt19937 gen(42);
+
+    std::cout << "size\tnaive_gflops\ttiled_gflops" << std::endl;
+    for (size_t n = 64; n <= max_size; n *= 2) {
+        Matrix a(n, n), b(n, n), c(n, n), ref(n, n);
+        fill(a, gen);
+        fill(b, gen);
+        double flops = 2.0 * n * n * n;
+
+        double tiled = seconds([&] { multiply(c, a, b); });
+        std::cout << n << '\t';
+        if (n <= max_naive) {
+            double naive = seconds([&] { naive_multiply(ref, a, b); });
+            if (max_diff(c, ref) > 1e-9 * n) {
+                std::cerr << "mismatch at size " << n << std::endl;
+                return 1;
+            }
+            std::cout << flops / naive * 1e-9;
+        } else {
+            std::cout << '-';
+        }
+        std::cout << '\t' << flops / tiled * 1e-9 << std::endl;
+    }
+    return 0;
+}
+
+/* Strong scaling: fixed problem size, 1 .. max_threads threads */
+int
+bench_scaling(size_t n, size_t max_threads)
+{
+    std::mt19937 gen(42);
+    Matrix a(n, n), b(n, n), c(n, n), ref(n, n);
+    fill(a, gen);
+    fill(b, gen);
+    Matrix::set_threads(1);
+    multiply(ref, a, b);
+
+    std::cout << "threads\tmultiply_sec\tadd_sec\tscale_sec\tequal_sec\tspeedup" << std::endl;
+    double base = 0;
+    for (size_t t = 1; t <= max_threads; ++t) {
+        Matrix::set_threads(t);
+        double mul = seconds([&] { multiply(c, a, b); });
+        bool eq = false;
+        double equal = seconds([&] { eq = c == ref; });
+        if (!eq) {
+            std::cerr << "mismatch at " << t << " threads" << std::endl;
+            return 1;
+        }
+        double add = seconds([&] { c += a; c -= a; });
+        double scale = seconds([&] { c *= 1.5; c *= 2; });
+        if (t == 1)
+            base = mul;
+        std::cout << t << '\t' << mul << '\t' << add << '\t' << scale << '\t' << equal
+                  << '\t' << base / mul << std::endl;
+    }
+    Matrix::set_threads(1);
+    return 0;
+}
+
+/* D = A * 2 + B - C: one step per temporary against one fused loop.
+ * Bandwidth counts the traffic of the fused loop: three reads and one write. */
+int
+bench_fused(size_t n, size_t iters)
+{
+    std::mt19937 gen(42);
+    Matrix a(n, n), b(n, n), c(n, n), d(n, n), ref(n, n);
+    fill(a, gen);
+    fill(b, gen);
+    fill(c, gen);
+
+    double naive = seconds([&] {
+        for (size_t it = 0; it < iters; ++it) {
+            Matrix t1(a);
+            t1 *= 2;
+            Matrix t2(t1);
+            t2 += b;
+            Matrix t3(t2);
+            t3 -= c;
+            ref = std::move(t3);
+        }
+    });
+    double fused = seconds([&] {
+        for (size_t it = 0; it < iters; ++it)
+            d = a * 2 + b - c;
+    });
+    if (d != ref) {
+        std::cerr << "mismatch" << std::endl;
+        return 1;
+    }
+
+    double bytes = 4.0 * n * n * sizeof(double) * iters;
+    std::cout << "variant\tsec\teffective_gb_per_sec" << std::endl;
+    std::cout << "temporaries\t" << naive << '\t' << bytes / naive * 1e-9 << std::endl;
+    std::cout << "fused\t" << fused << '\t' << bytes / fused * 1e-9 << std::endl;
+    return 0;
+}
+
+/* Sum of every row through m[i][j], m(i, j) and row spans */
+int
+bench_rowsum(size_t n, size_t iters)
+{
+    std::mt19937 gen(42);
+    Matrix m(n, n);
+    fill(m, gen);
+    std::vector<double> s1(n), s2(n), s3(n);
+
+    double checked = seconds([&] {
+        for (size_t it = 0; it < iters; ++it)
+            for (size_t i = 0; i < n; ++i) {
+                double sum = 0;
+                for (size_t j = 0; j < n; ++j)
+                    sum += m[i][j];
+                s1[i] = sum;
+            }
+    });
+    double unchecked = seconds([&] {
+        for (size_t it = 0; it < iters; ++it)
+            for (size_t i = 0; i < n; ++i) {
+                double sum = 0;
+                for (size_t j = 0; j < n; ++j)
+                    sum += m(i, j);
+                s2[i] = sum;
+            }
+    });
+    double span = seconds([&] {
+        for (size_t it = 0; it < iters; ++it)
+            for (size_t i = 0; i < n; ++i) {
+                double sum = 0;
+                for (double x : m.row(i))
+                    sum += x;
+                s3[i] = sum;
+            }
+    });
+    if (s1 != s2 || s1 != s3) {
+        std::cerr << "mismatch" << std::endl;
+        return 1;
+    }
+
+    double elems = double(n) * n * iters;
+    std::cout << "access\tns_per_element" << std::endl;
+    std::cout << "operator[]\t" << checked / elems * 1e9 << std::endl;
+    std::cout << "operator()\t" << unchecked / elems * 1e9 << std::endl;
+    std::cout << "row span\t" << span / elems * 1e9 << std::endl;
+    return 0;
+}
+
+/* Dense and CSR storage over a range of densities */
+int
+bench_sparse(size_t n, size_t rhs_cols)
+{
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(0, 1);
+    Matrix b(n, rhs_cols);
+    fill(b, gen);
+    std::vector<double> x(n);
+    for (auto &v : x)
+        v = dist(gen);
+
+    std::cout << "density\tdense_bytes\tcsr_bytes\tdense_mv_sec\tcsr_mv_sec\tdense_mm_sec\tcsr_mm_sec" << std::endl;
+    for (double density : { 0.001, 0.01, 0.05, 0.1, 0.2, 0.5 }) {
+        Matrix a(n, n);
+        for (size_t i = 0; i < n; ++i)
+            for (double &v : a.row(i))
+                v = dist(gen) < density ? dist(gen) : 0;
+        SparseMatrix s(a);
+
+        std::vector<double> y1, y2;
+        double dense_mv = seconds([&] { y1 = a * x; });
+        double csr_mv = seconds([&] { y2 = s * x; });
+        Matrix c1(0, 0), c2(0, 0);
+        double dense_mm = seconds([&] { c1 = a * b; });
+        double csr_mm = seconds([&] { c2 = s * b; });
+
+        double diff = max_diff(c1, c2);
+        for (size_t i = 0; i < n; ++i)
+            diff = std::max(diff, std::fabs(y1[i] - y2[i]));
+        if (diff > 1e-9 * n) {
+            std::cerr << "mismatch at density " << density << std::endl;
+            return 1;
+        }
+        std::cout << density << '\t' << n * n * sizeof(double) << '\t' << s.memory() << '\t'
+                  << dense_mv << '\t' << csr_mv << '\t' << dense_mm << '\t' << csr_mm << std::endl;
+    }
+    return 0;
+}
+
+/* File-backed product with a bounded tile budget against in-memory product */
+int
+bench_file(size_t n, size_t budget_mb)
+{
+    std::mt19937 gen(42);
+    double in_memory, out_of_core, diff;
+    {
+        MatrixFile fa("bench_a.mat", n, n), fb("bench_b.mat", n, n), fc("bench_c.mat", n, n);
+        fill(fa.matrix(), gen);
+        fill(fb.matrix(), gen);
+        fa.sync();
+        fb.sync();
+        out_of_core = seconds([&] {
+            multiply_out_of_core(fc, fa, fb, budget_mb << 20);
+            fc.sync();
+        });
+        Matrix c(0, 0);
+        in_memory = seconds([&] { c = fa.matrix() * fb.matrix(); });
+        diff = max_diff(c, fc.matrix());
+    }
+    std::remove("bench_a.mat");
+    std::remove("bench_b.mat");
+    std::remove("bench_c.mat");
+    if (diff > 1e-9 * n) {
+        std::cerr << "mismatch " << diff << std::endl;
+        return 1;
+    }
+    std::cout << "size\tbudget_mb\tin_memory_sec\tout_of_core_sec" << std::endl;
+    std::cout << n << '\t' << budget_mb << '\t' << in_memory << '\t' << out_of_core << std::endl;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "gemm")
+        return bench_gemm(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4096,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1024);
+    if (mode == "scaling")
+        return bench_scaling(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : std::thread::hardware_concurrency());
+
+    if (mode == "fused")
+        return bench_fused(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4096,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10);
+    if (mode == "rowsum")
+        return bench_rowsum(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10);
+    if (mode == "sparse")
+        return bench_sparse(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 64);
+    if (mode == "file")
+        return bench_file(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 16);
+
+    std::cerr << "Usage: bench gemm [max_size] [max_naive_size]" << std::endl;
+    std::cerr << "       bench scaling [size] [max_threads]" << std::endl;
+    std::cerr << "       bench fused [size] [iterations]" << std::endl;
+    std::cerr << "       bench rowsum [size] [iterations]" << std::endl;
+    std::cerr << "       bench sparse [size] [dense_rhs_columns]" << std::endl;
+    std::cerr << "       bench file [size] [budget_mb]" << std::endl;
+    return 1;
+}
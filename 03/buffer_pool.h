@@ -0,0 +1,89 @@
+#pragma once
+
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+#include <cstdlib>
+
+/* Storage for Matrix data: 64-byte aligned arrays of doubles.
+ * Released buffers are kept in per-size free lists and handed out again
+ * to the next matrix with the same number of elements. */
+class BufferPool
+{
+    std::mutex lock;
+    std::unordered_map<size_t, std::vector<double *>> free_lists;
+    size_t max_cached;
+    size_t cached;
+
+    BufferPool(const BufferPool &);
+    BufferPool &operator=(const BufferPool &);
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    static double *
+    allocate(size_t n)
+    {
+        /* aligned_alloc wants size to be a multiple of alignment */
+        size_t bytes = (n * sizeof(double) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        void *p = std::aligned_alloc(ALIGNMENT, bytes ? bytes : ALIGNMENT);
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<double *>(p);
+    }
+
+    static void
+    deallocate(double *p)
+    {
+        std::free(p);
+    }
+
+    /* keeps at most max_cached free buffers */
+    explicit BufferPool(size_t max_cached=1024): max_cached(max_cached), cached(0) { }
+
+    ~BufferPool()
+    {
+        for (auto &list : free_lists)
+            for (double *p : list.second)
+                deallocate(p);
+    }
+
+    double *
+    acquire(size_t n)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = free_lists.find(n);
+            if (it != free_lists.end() && !it->second.empty()) {
+                double *p = it->second.back();
+                it->second.pop_back();
+                --cached;
+                return p;
+            }
+        }
+        return allocate(n);
+    }
+
+    void
+    release(double *p, size_t n)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (cached < max_cached) {
+                free_lists[n].push_back(p);
+                ++cached;
+                return;
+            }
+        }
+        deallocate(p);
+    }
+
+    size_t
+    size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return cached;
+    }
+};
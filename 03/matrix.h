@@ -1,13 +1,178 @@
 #pragma once
 
 #include <exception>
+#include <stdexcept>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
 
-class Matrix 
+#include <cstddef>
+
+#include "thread_pool.h"
+#include "buffer_pool.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+class Matrix;
+
+/* Expression templates: A * 2 + B - C builds a tree of small objects,
+ * and assigning it to Matrix evaluates the whole tree in one loop over
+ * elements, without temporary matrices. */
+template <class E>
+class MatrixExpr
+{
+public:
+    const E &
+    self() const
+    {
+        return static_cast<const E &>(*this);
+    }
+};
+
+/* matrices are kept by reference, expression nodes by value */
+template <class E>
+struct ExprStorage
+{
+    typedef const E type;
+};
+
+template <>
+struct ExprStorage<Matrix>
 {
-    const size_t rows;
-    const size_t cols;
-    const size_t n;
+    typedef const Matrix &type;
+};
+
+struct AddOp
+{
+    static double apply(double x, double y) { return x + y; }
+};
+
+struct SubOp
+{
+    static double apply(double x, double y) { return x - y; }
+};
+
+template <class L, class R, class Op>
+class BinaryExpr: public MatrixExpr<BinaryExpr<L, R, Op>>
+{
+    typename ExprStorage<L>::type l;
+    typename ExprStorage<R>::type r;
+
+public:
+    BinaryExpr(const L &l, const R &r): l(l), r(r)
+    {
+        if (l.getRows() != r.getRows() || l.getColumns() != r.getColumns())
+            throw std::invalid_argument("matrix sizes do not match");
+    }
+
+    size_t getRows() const { return l.getRows(); }
+    size_t getColumns() const { return l.getColumns(); }
+
+    /* element by index in row-major order */
+    double at(size_t i) const
+    {
+        return Op::apply(l.at(i), r.at(i));
+    }
+};
+
+template <class E>
+class ScaleExpr: public MatrixExpr<ScaleExpr<E>>
+{
+    typename ExprStorage<E>::type e;
+    double x;
+
+public:
+    ScaleExpr(const E &e, double x): e(e), x(x) { }
+
+    size_t getRows() const { return e.getRows(); }
+    size_t getColumns() const { return e.getColumns(); }
+
+    double at(size_t i) const
+    {
+        return e.at(i) * x;
+    }
+};
+
+template <class L, class R>
+BinaryExpr<L, R, AddOp>
+operator+ (const MatrixExpr<L> &l, const MatrixExpr<R> &r)
+{
+    return BinaryExpr<L, R, AddOp>(l.self(), r.self());
+}
+
+template <class L, class R>
+BinaryExpr<L, R, SubOp>
+operator- (const MatrixExpr<L> &l, const MatrixExpr<R> &r)
+{
+    return BinaryExpr<L, R, SubOp>(l.self(), r.self());
+}
+
+template <class E>
+ScaleExpr<E>
+operator* (const MatrixExpr<E> &e, double x)
+{
+    return ScaleExpr<E>(e.self(), x);
+}
+
+template <class E>
+ScaleExpr<E>
+operator* (double x, const MatrixExpr<E> &e)
+{
+    return ScaleExpr<E>(e.self(), x);
+}
+
+class Matrix: public MatrixExpr<Matrix>
+{
+    size_t rows;
+    size_t cols;
+    size_t n;
+    /* 64-byte aligned, owned by buffers when it is set */
     double *data;
+    BufferPool *buffers;
+    /* false for views over external storage, see MatrixFile */
+    bool owned;
+
+    double *
+    acquire(size_t n)
+    {
+        return buffers ? buffers->acquire(n) : BufferPool::allocate(n);
+    }
+
+    struct ViewTag { };
+
+    /* the caller has rows*cols doubles at storage, so the size is valid */
+    Matrix(const size_t rows, const size_t cols, double *storage, ViewTag):
+        rows(rows), cols(cols), n(rows*cols), data(storage), buffers(nullptr), owned(false)
+    {
+    }
+
+    /* views have fixed storage, so only same-sized matrices fit */
+    void
+    check_view(size_t r, size_t c) const
+    {
+        if (!owned && (rows != r || cols != c))
+            throw std::invalid_argument("matrix view can't be resized");
+    }
+
+    void
+    release()
+    {
+        if (!data)
+            return;
+        if (!owned)
+            ;
+        else if (buffers)
+            buffers->release(data, n);
+        else
+            BufferPool::deallocate(data);
+        data = nullptr;
+    }
 
     static bool 
     check_range(size_t i, size_t l) 
@@ -24,6 +189,198 @@ class Matrix
         return r;
     }
 
+    /* Tile sizes for multiplication: MC x KC block of A and KC x NC block of B
+     * stay in L2 while MR x NR block of C is kept in registers */
+    static constexpr size_t MC = 64;
+    static constexpr size_t KC = 256;
+    static constexpr size_t NC = 512;
+    static constexpr size_t MR = 4;
+    static constexpr size_t NR = 8;
+
+    /* c[MR x NR] += a[MR x kc] * b[kc x NR] */
+    static void
+    micro_kernel(const double *a, size_t lda, const double *b, size_t ldb, double *c, size_t ldc, size_t kc)
+    {
+#if defined(__AVX2__) && defined(__FMA__)
+        __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+        __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+        __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+        __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+        for (size_t k = 0; k < kc; ++k) {
+            __m256d b0 = _mm256_loadu_pd(b + k*ldb);
+            __m256d b1 = _mm256_loadu_pd(b + k*ldb + 4);
+            __m256d x = _mm256_broadcast_sd(a + k);
+            c00 = _mm256_fmadd_pd(x, b0, c00);
+            c01 = _mm256_fmadd_pd(x, b1, c01);
+            x = _mm256_broadcast_sd(a + lda + k);
+            c10 = _mm256_fmadd_pd(x, b0, c10);
+            c11 = _mm256_fmadd_pd(x, b1, c11);
+            x = _mm256_broadcast_sd(a + 2*lda + k);
+            c20 = _mm256_fmadd_pd(x, b0, c20);
+            c21 = _mm256_fmadd_pd(x, b1, c21);
+            x = _mm256_broadcast_sd(a + 3*lda + k);
+            c30 = _mm256_fmadd_pd(x, b0, c30);
+            c31 = _mm256_fmadd_pd(x, b1, c31);
+        }
+        _mm256_storeu_pd(c, _mm256_add_pd(_mm256_loadu_pd(c), c00));
+        _mm256_storeu_pd(c + 4, _mm256_add_pd(_mm256_loadu_pd(c + 4), c01));
+        _mm256_storeu_pd(c + ldc, _mm256_add_pd(_mm256_loadu_pd(c + ldc), c10));
+        _mm256_storeu_pd(c + ldc + 4, _mm256_add_pd(_mm256_loadu_pd(c + ldc + 4), c11));
+        _mm256_storeu_pd(c + 2*ldc, _mm256_add_pd(_mm256_loadu_pd(c + 2*ldc), c20));
+        _mm256_storeu_pd(c + 2*ldc + 4, _mm256_add_pd(_mm256_loadu_pd(c + 2*ldc + 4), c21));
+        _mm256_storeu_pd(c + 3*ldc, _mm256_add_pd(_mm256_loadu_pd(c + 3*ldc), c30));
+        _mm256_storeu_pd(c + 3*ldc + 4, _mm256_add_pd(_mm256_loadu_pd(c + 3*ldc + 4), c31));
+#else
+        double acc[MR][NR] = {};
+        for (size_t k = 0; k < kc; ++k)
+            for (size_t i = 0; i < MR; ++i)
+                for (size_t j = 0; j < NR; ++j)
+                    acc[i][j] += a[i*lda + k] * b[k*ldb + j];
+        for (size_t i = 0; i < MR; ++i)
+            for (size_t j = 0; j < NR; ++j)
+                c[i*ldc + j] += acc[i][j];
+#endif
+    }
+
+    /* c[mc x nc] += a[mc x kc] * b[kc x nc] for leftovers of the tiling */
+    static void
+    edge_kernel(const double *a, size_t lda, const double *b, size_t ldb, double *c, size_t ldc,
+            size_t mc, size_t kc, size_t nc)
+    {
+        for (size_t i = 0; i < mc; ++i)
+            for (size_t k = 0; k < kc; ++k) {
+                double x = a[i*lda + k];
+                for (size_t j = 0; j < nc; ++j)
+                    c[i*ldc + j] += x * b[k*ldb + j];
+            }
+    }
+
+    /* c[m x n] += a[m x k] * b[k x n], all row-major with leading dimensions lda, ldb, ldc */
+    static void
+    gemm(const double *a, size_t lda, const double *b, size_t ldb, double *c, size_t ldc,
+            size_t m, size_t k, size_t n)
+    {
+        for (size_t j0 = 0; j0 < n; j0 += NC) {
+            size_t nc = std::min(NC, n - j0);
+            for (size_t k0 = 0; k0 < k; k0 += KC) {
+                size_t kc = std::min(KC, k - k0);
+                for (size_t i0 = 0; i0 < m; i0 += MC) {
+                    size_t mc = std::min(MC, m - i0);
+                    size_t mr_end = mc / MR * MR;
+                    size_t nr_end = nc / NR * NR;
+                    for (size_t i = 0; i < mr_end; i += MR)
+                        for (size_t j = 0; j < nr_end; j += NR)
+                            micro_kernel(a + (i0+i)*lda + k0, lda, b + k0*ldb + j0+j, ldb,
+                                    c + (i0+i)*ldc + j0+j, ldc, kc);
+                    if (nr_end < nc)
+                        edge_kernel(a + i0*lda + k0, lda, b + k0*ldb + j0+nr_end, ldb,
+                                c + i0*ldc + j0+nr_end, ldc, mr_end, kc, nc - nr_end);
+                    if (mr_end < mc)
+                        edge_kernel(a + (i0+mr_end)*lda + k0, lda, b + k0*ldb + j0, ldb,
+                                c + (i0+mr_end)*ldc + j0, ldc, mc - mr_end, kc, nc);
+                }
+            }
+        }
+    }
+
+    /* y[m] = a[m x n] * x[n] */
+    static void
+    gemv(const double *a, const double *x, double *y, size_t m, size_t n)
+    {
+        for (size_t i = 0; i < m; ++i) {
+            const double *row = a + i*n;
+            size_t j = 0;
+            double sum = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+            __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+            for (; j + 8 <= n; j += 8) {
+                s0 = _mm256_fmadd_pd(_mm256_loadu_pd(row + j), _mm256_loadu_pd(x + j), s0);
+                s1 = _mm256_fmadd_pd(_mm256_loadu_pd(row + j + 4), _mm256_loadu_pd(x + j + 4), s1);
+            }
+            double part[4];
+            _mm256_storeu_pd(part, _mm256_add_pd(s0, s1));
+            sum = (part[0] + part[1]) + (part[2] + part[3]);
+#endif
+            for (; j < n; ++j)
+                sum += row[j] * x[j];
+            y[i] = sum;
+        }
+    }
+
+    /* elements per tile of element-wise operations */
+    static constexpr size_t TILE = 1 << 14;
+
+    static std::mutex &
+    pool_lock()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::shared_ptr<ThreadPool> &
+    pool()
+    {
+        static std::shared_ptr<ThreadPool> p;
+        return p;
+    }
+
+    /* f(beg, end) over [0, len), split into tiles when the pool is set */
+    template <class F>
+    static void
+    for_tiles(size_t len, F f)
+    {
+        std::shared_ptr<ThreadPool> p = get_pool();
+        if (!p || len < 2 * TILE) {
+            f(0, len);
+            return;
+        }
+        p->run((len + TILE - 1) / TILE, [&](size_t t) {
+            f(t * TILE, std::min(len, (t + 1) * TILE));
+        });
+    }
+
+    void
+    scale(double x) const
+    {
+        double *d = data;
+        for_tiles(n, [=](size_t beg, size_t end) {
+            for (size_t i = beg; i < end; ++i)
+                d[i] *= x;
+        });
+    }
+
+    template <class E>
+    void
+    check_same_size(const E &m) const
+    {
+        if (rows != m.getRows() || cols != m.getColumns())
+            throw std::invalid_argument("matrix sizes do not match");
+    }
+
+    /* d[i] = op(d[i], e.at(i)) in one pass */
+    template <class E, class Op>
+    void
+    apply(const E &e, Op op)
+    {
+        double *d = data;
+        for_tiles(n, [&, d](size_t beg, size_t end) {
+            for (size_t i = beg; i < end; ++i)
+                d[i] = op(d[i], e.at(i));
+        });
+    }
+
+    /* checks of the unchecked API, compiled in with -DMATRIX_DEBUG */
+    static void
+    debug_check(size_t i, size_t l, const char *what)
+    {
+#ifdef MATRIX_DEBUG
+        if (i >= l)
+            throw std::out_of_range(what);
+#else
+        (void) i, (void) l, (void) what;
+#endif
+    }
+
     class MatrixProxy {
         const size_t cols;
         double *data;
@@ -57,18 +414,134 @@ class Matrix
     };
 
 public:
-    Matrix(const size_t rows, const size_t cols):
-        rows(rows), cols(cols), n(rows*cols)
+    /* buffers, when given, must outlive the matrix */
+    Matrix(const size_t rows, const size_t cols, BufferPool *buffers=nullptr):
+        rows(rows), cols(cols), n(rows*cols), data(nullptr), buffers(buffers), owned(true)
     {
         if (ord2(rows) + ord2(cols) + 2 > 8*sizeof n)
             throw std::bad_array_new_length();
 
-        data = new double[n];
+        data = acquire(n);
+    }
+
+    /* View over rows*cols doubles owned by somebody else, e.g. file mapping;
+     * storage must outlive it. Assignments copy elements into the storage
+     * and throw std::invalid_argument when sizes differ. */
+    static Matrix
+    view(const size_t rows, const size_t cols, double *storage)
+    {
+        return Matrix(rows, cols, storage, ViewTag());
+    }
+
+    Matrix(const Matrix &m):
+        rows(m.rows), cols(m.cols), n(m.n), data(nullptr), buffers(m.buffers), owned(true)
+    {
+        data = acquire(n);
+        std::copy(m.data, m.data + n, data);
+    }
+
+    Matrix(Matrix &&m) noexcept:
+        rows(m.rows), cols(m.cols), n(m.n), data(m.data), buffers(m.buffers), owned(m.owned)
+    {
+        m.rows = m.cols = m.n = 0;
+        m.data = nullptr;
+        m.owned = true;
+    }
+
+    Matrix &
+    operator= (const Matrix &m)
+    {
+        if (this == &m)
+            return *this;
+        check_view(m.rows, m.cols);
+        if (owned && (n != m.n || buffers != m.buffers)) {
+            double *p = m.buffers ? m.buffers->acquire(m.n) : BufferPool::allocate(m.n);
+            release();
+            data = p;
+            buffers = m.buffers;
+            owned = true;
+        }
+        rows = m.rows;
+        cols = m.cols;
+        n = m.n;
+        std::copy(m.data, m.data + n, data);
+        return *this;
+    }
+
+    /* moving into a view copies elements, so it may throw */
+    Matrix &
+    operator= (Matrix &&m) noexcept(false)
+    {
+        if (this == &m)
+            return *this;
+        if (!owned)
+            return *this = static_cast<const Matrix &>(m);
+        release();
+        rows = m.rows;
+        cols = m.cols;
+        n = m.n;
+        data = m.data;
+        buffers = m.buffers;
+        owned = m.owned;
+        m.rows = m.cols = m.n = 0;
+        m.data = nullptr;
+        m.owned = true;
+        return *this;
+    }
+
+    template <class E>
+    Matrix(const MatrixExpr<E> &e, BufferPool *buffers=nullptr):
+        Matrix(e.self().getRows(), e.self().getColumns(), buffers)
+    {
+        apply(e.self(), [](double, double y) { return y; });
+    }
+
+    /* Elements of e may refer to this matrix: element i is read before it is written */
+    template <class E>
+    Matrix &
+    operator= (const MatrixExpr<E> &e)
+    {
+        const E &expr = e.self();
+        check_view(expr.getRows(), expr.getColumns());
+        if (rows != expr.getRows() || cols != expr.getColumns()) {
+            /* sizes differ, so expression does not use this matrix */
+            Matrix m(expr.getRows(), expr.getColumns(), buffers);
+            *this = std::move(m);
+        }
+        apply(expr, [](double, double y) { return y; });
+        return *this;
     }
 
     ~Matrix()
     {
-        delete[] data;
+        release();
+    }
+
+    /* Number of threads used by element-wise operations and multiplication,
+     * 1 means everything runs in the calling thread */
+    static void
+    set_threads(size_t threads)
+    {
+        std::shared_ptr<ThreadPool> p(threads > 1 ? new ThreadPool(threads) : nullptr);
+        std::lock_guard<std::mutex> guard(pool_lock());
+        /* operations already running keep their own reference */
+        pool().swap(p);
+    }
+
+    static size_t
+    get_threads()
+    {
+        std::shared_ptr<ThreadPool> p = get_pool();
+        return p ? p->size() : 1;
+    }
+
+    /* pool installed by set_threads(), nullptr in sequential mode; callers
+     * hold the reference while they run jobs on it */
+    static std::shared_ptr<ThreadPool>
+    get_pool()
+    {
+        std::lock_guard<std::mutex> guard(pool_lock());
+        return pool();
     }
 
     size_t getRows() const
@@ -80,6 +553,59 @@ public:
         return cols;
     }
 
+    /* Contiguous row without range checks and negative indices */
+    template <class T>
+    class RowSpan {
+        T *ptr;
+        size_t len;
+    public:
+        RowSpan(T *ptr, size_t len): ptr(ptr), len(len) { }
+
+        T &
+        operator[] (size_t j) const
+        {
+            debug_check(j, len, "last index out of range");
+            return ptr[j];
+        }
+
+        T *data() const { return ptr; }
+        T *begin() const { return ptr; }
+        T *end() const { return ptr + len; }
+        size_t size() const { return len; }
+    };
+
+    /* Unchecked access for inner loops; with MATRIX_DEBUG indices are
+     * checked, but negative ones are not wrapped around as in operator[] */
+    double &
+    operator() (size_t i, size_t j)
+    {
+        debug_check(i, rows, "first index out of range");
+        debug_check(j, cols, "last index out of range");
+        return data[i*cols + j];
+    }
+
+    const double &
+    operator() (size_t i, size_t j) const
+    {
+        debug_check(i, rows, "first index out of range");
+        debug_check(j, cols, "last index out of range");
+        return data[i*cols + j];
+    }
+
+    RowSpan<double>
+    row(size_t i)
+    {
+        debug_check(i, rows, "first index out of range");
+        return RowSpan<double>(data + i*cols, cols);
+    }
+
+    RowSpan<const double>
+    row(size_t i) const
+    {
+        debug_check(i, rows, "first index out of range");
+        return RowSpan<const double>(data + i*cols, cols);
+    }
+
     const MatrixProxy
     operator[] (size_t i) const
     {
@@ -107,32 +633,129 @@ public:
     const Matrix &
     operator*= (double x) const
     {
-        for (size_t i = 0; i < n; ++i)
-            data[i] *= x;
+        scale(x);
         return *this;
     }
     
     Matrix &
     operator*= (double x)
     {
-        for (size_t i = 0; i < n; ++i)
-            data[i] *= x;
+        scale(x);
+        return *this;
+    }
+
+    template <class E>
+    Matrix &
+    operator+= (const MatrixExpr<E> &e)
+    {
+        check_same_size(e.self());
+        apply(e.self(), [](double x, double y) { return x + y; });
+        return *this;
+    }
+
+    template <class E>
+    Matrix &
+    operator-= (const MatrixExpr<E> &e)
+    {
+        check_same_size(e.self());
+        apply(e.self(), [](double x, double y) { return x - y; });
         return *this;
     }
 
+    double
+    at(size_t i) const
+    {
+        return data[i];
+    }
+
     bool operator== (const Matrix &m) const
     {
         if (this == &m)
             return true;
         if (m.n != n)
             return false;
-        for (size_t i = 0; i < n; ++i)
-            if (data[i] != m.data[i])
-                return false;
-        return true;
+        const double *x = data;
+        const double *y = m.data;
+        std::atomic<bool> equal(true);
+        for_tiles(n, [&](size_t beg, size_t end) {
+            if (!equal.load(std::memory_order_relaxed))
+                return;
+            for (size_t i = beg; i < end; ++i)
+                if (x[i] != y[i]) {
+                    equal.store(false, std::memory_order_relaxed);
+                    return;
+                }
+        });
+        return equal;
     }
     bool operator!= (const Matrix &m) const
     {
         return !(*this == m);
     }
+
+    /* c = a * b; c must not be a or b */
+    friend void
+    multiply(Matrix &c, const Matrix &a, const Matrix &b)
+    {
+        product(c, a, b, false);
+    }
+
+    /* c += a * b; c must not be a or b */
+    friend void
+    multiply_add(Matrix &c, const Matrix &a, const Matrix &b)
+    {
+        product(c, a, b, true);
+    }
+
+    static void
+    product(Matrix &c, const Matrix &a, const Matrix &b, bool accumulate)
+    {
+        if (a.cols != b.rows || c.rows != a.rows || c.cols != b.cols)
+            throw std::invalid_argument("matrix sizes do not match");
+        if (&c == &a || &c == &b)
+            throw std::invalid_argument("result aliases operand");
+
+        size_t m = a.rows, k = a.cols, n = b.cols;
+        std::shared_ptr<ThreadPool> p = get_pool();
+        if (!p) {
+            if (!accumulate)
+                std::fill(c.data, c.data + c.n, 0.0);
+            gemm(a.data, k, b.data, n, c.data, n, m, k, n);
+            return;
+        }
+        /* tiles of MC x NC elements of c, each computed over whole k */
+        size_t row_tiles = (m + MC - 1) / MC;
+        size_t col_tiles = (n + NC - 1) / NC;
+        p->run(row_tiles * col_tiles, [&](size_t t) {
+            size_t i0 = t / col_tiles * MC;
+            size_t j0 = t % col_tiles * NC;
+            size_t mc = std::min(MC, m - i0);
+            size_t nc = std::min(NC, n - j0);
+            double *ct = c.data + i0*n + j0;
+            if (!accumulate)
+                for (size_t i = 0; i < mc; ++i)
+                    std::fill(ct + i*n, ct + i*n + nc, 0.0);
+            gemm(a.data + i0*k, k, b.data + j0, n, ct, n, mc, k, nc);
+        });
+    }
+
+    Matrix
+    operator* (const Matrix &m) const
+    {
+        if (cols != m.rows)
+            throw std::invalid_argument("matrix sizes do not match");
+        Matrix res(rows, m.cols, buffers);
+        multiply(res, *this, m);
+        return res;
+    }
+
+    std::vector<double>
+    operator* (const std::vector<double> &v) const
+    {
+        if (v.size() != cols)
+            throw std::invalid_argument("vector size does not match");
+        std::vector<double> res(rows);
+        gemv(data, v.data(), res.data(), rows, cols);
+        return res;
+    }
 };
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix.h"
+
+/* err is errno of the failed call, 0 when no system call failed */
+class MatrixFileError: public std::runtime_error
+{
+    static std::string
+    message(const std::string &what, const std::string &filename, int err)
+    {
+        std::string msg = what + " '" + filename + "'";
+        if (err)
+            msg += ". errno=" + std::to_string(err);
+        return msg;
+    }
+public:
+    MatrixFileError(const std::string &what, const std::string &filename, int err=0):
+        std::runtime_error(message(what, filename, err))
+    { }
+};
+
+/* Matrix stored in a shared file mapping: 64-byte header with sizes,
+ * then rows*cols doubles row by row. Pages are loaded by the kernel on
+ * access, so the matrix may be larger than RAM. A file opened read-only
+ * is mapped privately: writes to its matrix stay in memory. */
+class MatrixFile
+{
+    struct Header {
+        char magic[8];
+        uint64_t rows;
+        uint64_t cols;
+        char reserved[40];
+    };
+    static_assert(sizeof(Header) == 64, "header keeps data cache line aligned");
+
+    static constexpr char MAGIC[8] = { 'M', 'A', 'T', 'R', 'I', 'X', '0', '1' };
+
+    std::string filename;
+    int fd;
+    size_t size;
+    void *ptr;
+    Matrix view;
+
+    MatrixFile(const MatrixFile &);
+    MatrixFile &operator=(const MatrixFile &);
+
+    void *
+    map(bool shared)
+    {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            throw MatrixFileError("Can't mmap file", filename, err);
+        }
+        return p;
+    }
+
+    Header *
+    header() const
+    {
+        return static_cast<Header *>(ptr);
+    }
+
+    double *
+    storage() const
+    {
+        return reinterpret_cast<double *>(header() + 1);
+    }
+
+    static size_t
+    file_size(size_t rows, size_t cols)
+    {
+        if (cols && rows > (SIZE_MAX - sizeof(Header)) / sizeof(double) / cols)
+            throw std::bad_array_new_length();
+        return sizeof(Header) + rows * cols * sizeof(double);
+    }
+
+    /* open_file() and create_file() run from the constructors' initializer
+     * lists: they set fd and size and return the mapping, so the view is
+     * made once, over its final storage */
+    void *
+    open_file(bool writable)
+    {
+        fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd == -1)
+            throw MatrixFileError("Can't open file", filename, errno);
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            int err = errno;
+            close(fd);
+            throw MatrixFileError("Can't stat file", filename, err);
+        }
+        size = st.st_size;
+        if (size < sizeof(Header)) {
+            close(fd);
+            throw MatrixFileError("Invalid size of file", filename);
+        }
+        void *p = map(writable);
+
+        const Header *h = static_cast<const Header *>(p);
+        if (std::memcmp(h->magic, MAGIC, sizeof MAGIC) != 0 ||
+                (h->cols && h->rows > (size - sizeof(Header)) / sizeof(double) / h->cols) ||
+                file_size(h->rows, h->cols) != size) {
+            munmap(p, size);
+            close(fd);
+            throw MatrixFileError("Invalid header of file", filename);
+        }
+        return p;
+    }
+
+    void *
+    create_file(size_t rows, size_t cols)
+    {
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            throw MatrixFileError("Can't open file", filename, errno);
+        if (ftruncate(fd, size) == -1) {
+            int err = errno;
+            close(fd);
+            throw MatrixFileError("Can't truncate file", filename, err);
+        }
+        void *p = map(true);
+
+        Header *h = static_cast<Header *>(p);
+        std::memcpy(h->magic, MAGIC, sizeof MAGIC);
+        h->rows = rows;
+        h->cols = cols;
+        return p;
+    }
+public:
+    /* open existing file */
+    MatrixFile(const std::string &filename, bool writable=false):
+        filename(filename), fd(-1), size(0), ptr(open_file(writable)),
+        view(Matrix::view(header()->rows, header()->cols, storage()))
+    {
+    }
+
+    /* create or truncate file for rows x cols matrix filled with zeros */
+    MatrixFile(const std::string &filename, size_t rows, size_t cols):
+        filename(filename), fd(-1), size(file_size(rows, cols)), ptr(create_file(rows, cols)),
+        view(Matrix::view(rows, cols, storage()))
+    {
+    }
+
+    ~MatrixFile()
+    {
+        if (ptr != MAP_FAILED)
+            munmap(ptr, size);
+        close(fd);
+    }
+
+    /* writes to a read-only file are not saved;
+     * assignments must keep the size, see Matrix::view() */
+    Matrix &matrix() { return view; }
+    const Matrix &matrix() const { return view; }
+
+    void
+    sync()
+    {
+        if (msync(ptr, size, MS_SYNC) == -1)
+            throw MatrixFileError("Can't sync file", filename, errno);
+    }
+};
+
+/* c = a * b for file-backed matrices; at most budget bytes of tiles are
+ * resident in RAM: one tile of each operand is copied out of the mapping,
+ * multiplied in memory and the finished tile of c is written back. */
+inline void
+multiply_out_of_core(MatrixFile &c, const MatrixFile &a, const MatrixFile &b, size_t budget)
+{
+    const Matrix &ma = a.matrix(), &mb = b.matrix();
+    Matrix &mc = c.matrix();
+    size_t m = ma.getRows(), k = ma.getColumns(), n = mb.getColumns();
+    if (k != mb.getRows() || mc.getRows() != m || mc.getColumns() != n)
+        throw std::invalid_argument("matrix sizes do not match");
+
+    /* three square tiles of t x t doubles */
+    size_t t = std::sqrt(budget / (3 * sizeof(double)));
+    if (!t)
+        throw std::invalid_argument("memory budget is too small");
+
+    for (size_t i0 = 0; i0 < m; i0 += t) {
+        size_t tm = std::min(t, m - i0);
+        for (size_t j0 = 0; j0 < n; j0 += t) {
+            size_t tn = std::min(t, n - j0);
+            Matrix ct(tm, tn);
+            for (size_t i = 0; i < tm; ++i)
+                std::fill(ct.row(i).begin(), ct.row(i).end(), 0.0);
+            for (size_t p0 = 0; p0 < k; p0 += t) {
+                size_t tk = std::min(t, k - p0);
+                Matrix at(tm, tk), bt(tk, tn);
+                for (size_t i = 0; i < tm; ++i)
+                    std::copy_n(&ma(i0 + i, p0), tk, &at(i, 0));
+                for (size_t p = 0; p < tk; ++p)
+                    std::copy_n(&mb(p0 + p, j0), tn, &bt(p, 0));
+                multiply_add(ct, at, bt);
+            }
+            for (size_t i = 0; i < tm; ++i)
+                std::copy_n(&ct(i, 0), tn, &mc(i0 + i, j0));
+        }
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+
+#include "matrix.h"
+
+/* Compressed sparse row matrix: values and column indices of nonzero
+ * elements row by row, row i occupies [row_ptr[i], row_ptr[i+1]).
+ * Products run on Matrix thread pool when it is set. */
+class SparseMatrix
+{
+    size_t rows;
+    size_t cols;
+    std::vector<size_t> row_ptr;
+    std::vector<uint32_t> col_idx;
+    std::vector<double> values;
+
+    /* nonzeros per tile of parallel products */
+    static constexpr size_t TILE_NNZ = 1 << 14;
+
+    /* f(row_beg, row_end) over row ranges with about TILE_NNZ nonzeros each */
+    template <class F>
+    void
+    for_row_tiles(F f) const
+    {
+        std::shared_ptr<ThreadPool> p = Matrix::get_pool();
+        size_t nnz = values.size();
+        if (!p || nnz < 2 * TILE_NNZ) {
+            f(0, rows);
+            return;
+        }
+        size_t ntiles = (nnz + TILE_NNZ - 1) / TILE_NNZ;
+        std::vector<size_t> bounds(ntiles + 1, rows);
+        bounds[0] = 0;
+        for (size_t t = 1; t < ntiles; ++t)
+            bounds[t] = std::upper_bound(row_ptr.begin(), row_ptr.end(), t * TILE_NNZ) - row_ptr.begin() - 1;
+        p->run(ntiles, [&](size_t t) {
+            f(bounds[t], bounds[t+1]);
+        });
+    }
+
+public:
+    SparseMatrix(size_t rows, size_t cols):
+        rows(rows), cols(cols), row_ptr(rows + 1, 0)
+    {
+        if (cols > UINT32_MAX)
+            throw std::bad_array_new_length();
+    }
+
+    /* elements with |x| <= eps are dropped */
+    explicit SparseMatrix(const Matrix &m, double eps=0):
+        SparseMatrix(m.getRows(), m.getColumns())
+    {
+        for (size_t i = 0; i < rows; ++i) {
+            auto row = m.row(i);
+            for (size_t j = 0; j < cols; ++j)
+                if (std::fabs(row[j]) > eps) {
+                    col_idx.push_back(j);
+                    values.push_back(row[j]);
+                }
+            row_ptr[i+1] = values.size();
+        }
+    }
+
+    Matrix
+    to_dense(BufferPool *buffers=nullptr) const
+    {
+        Matrix m(rows, cols, buffers);
+        for (size_t i = 0; i < rows; ++i) {
+            auto row = m.row(i);
+            std::fill(row.begin(), row.end(), 0.0);
+            for (size_t k = row_ptr[i]; k < row_ptr[i+1]; ++k)
+                row[col_idx[k]] = values[k];
+        }
+        return m;
+    }
+
+    size_t getRows() const
+    {
+        return rows;
+    }
+    size_t getColumns() const
+    {
+        return cols;
+    }
+
+    size_t nonzeros() const
+    {
+        return values.size();
+    }
+
+    /* bytes used by the arrays */
+    size_t memory() const
+    {
+        return row_ptr.size() * sizeof(row_ptr[0]) + col_idx.size() * sizeof(col_idx[0])
+            + values.size() * sizeof(values[0]);
+    }
+
+    /* y = A * x */
+    std::vector<double>
+    operator* (const std::vector<double> &x) const
+    {
+        if (x.size() != cols)
+            throw std::invalid_argument("vector size does not match");
+        std::vector<double> y(rows);
+        for_row_tiles([&](size_t beg, size_t end) {
+            for (size_t i = beg; i < end; ++i) {
+                double sum = 0;
+                for (size_t k = row_ptr[i]; k < row_ptr[i+1]; ++k)
+                    sum += values[k] * x[col_idx[k]];
+                y[i] = sum;
+            }
+        });
+        return y;
+    }
+
+    /* C = A * B for dense B: every nonzero scales a row of B */
+    Matrix
+    operator* (const Matrix &b) const
+    {
+        if (cols != b.getRows())
+            throw std::invalid_argument("matrix sizes do not match");
+        size_t n = b.getColumns();
+        Matrix c(rows, n);
+        for_row_tiles([&](size_t beg, size_t end) {
+            for (size_t i = beg; i < end; ++i) {
+                auto crow = c.row(i);
+                std::fill(crow.begin(), crow.end(), 0.0);
+                double *cp = crow.data();
+                for (size_t k = row_ptr[i]; k < row_ptr[i+1]; ++k) {
+                    double v = values[k];
+                    const double *bp = b.row(col_idx[k]).data();
+                    for (size_t j = 0; j < n; ++j)
+                        cp[j] += v * bp[j];
+                }
+            }
+        });
+        return c;
+    }
+};
@@ -1,6 +1,13 @@
 #include <iostream>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
 
 #include "matrix.h"
+#include "sparse.h"
+#include "matrix_file.h"
 
 #define check_equal(x, y)  do { if ((x) != y) std::cout << "line " << __LINE__ << ": expected " << y << " got " << (x) << '\n'; } while(0)
 #define check(cond) do { if (!(cond)) std::cout << "line " << __LINE__ << ": " << #cond << '\n'; } while(0)
@@ -61,6 +68,237 @@ int main()
     check_throw(m1[0][-4], std::out_of_range);
     check_throw(m1[-3][0], std::out_of_range);
 
+    Matrix a(2, 3), b(3, 2);
+    n = 0;
+    for (int i = 0; i < 2; ++i)
+        for (int j = 0; j < 3; ++j) {
+            a[i][j] = ++n;
+            b[j][i] = n;
+        }
+    Matrix c = a * b;
+    check_equal(c.getRows(), 2);
+    check_equal(c.getColumns(), 2);
+    check_equal(c[0][0], 14);
+    check_equal(c[0][1], 32);
+    check_equal(c[1][0], 32);
+    check_equal(c[1][1], 77);
+    check_throw(a * a, std::invalid_argument);
+
+    std::vector<double> v = a * std::vector<double>{ 1, 0, -1 };
+    check_equal(v.size(), 2);
+    check_equal(v[0], -2);
+    check_equal(v[1], -2);
+
+    Matrix big(37, 53), id(53, 53), prod(37, 53);
+    for (int i = 0; i < 37; ++i)
+        for (int j = 0; j < 53; ++j)
+            big[i][j] = i * 100 + j;
+    for (int i = 0; i < 53; ++i)
+        for (int j = 0; j < 53; ++j)
+            id[i][j] = i == j;
+    multiply(prod, big, id);
+    check(prod == big);
+
+    Matrix p1(150, 210), p2(210, 130), seq(150, 130);
+    for (int i = 0; i < 150; ++i)
+        for (int j = 0; j < 210; ++j)
+            p1[i][j] = (i * 7 + j) % 13 - 6;
+    for (int i = 0; i < 210; ++i)
+        for (int j = 0; j < 130; ++j)
+            p2[i][j] = (i + j * 5) % 11 - 5;
+    multiply(seq, p1, p2);
+
+    Matrix::set_threads(3);
+    check_equal(Matrix::get_threads(), 3);
+    Matrix par = p1 * p2;
+    check(par == seq);
+    Matrix par2(150, 130);
+    std::thread other([&] {
+        for (int i = 0; i < 20; ++i)
+            multiply(par2, p1, p2);
+    });
+    Matrix par3 = p1 * p2;
+    Matrix::set_threads(2);
+    Matrix::set_threads(3);
+    other.join();
+    check(par2 == seq);
+    check(par3 == seq);
+    std::shared_ptr<ThreadPool> tp = Matrix::get_pool();
+    check_throw(tp->run(1, [&](size_t) { tp->run(2, [](size_t) {}); }), std::logic_error);
+    Matrix sum(150, 210);
+    for (int i = 0; i < 150; ++i)
+        for (int j = 0; j < 210; ++j)
+            sum[i][j] = 0;
+    sum += p1;
+    sum += p1;
+    p1 *= 2;
+    check(sum == p1);
+    sum -= p1;
+    check_equal(sum[149][209], 0);
+    p1[149][209] += 1;
+    check(sum != p1);
+    check_throw(sum += p2, std::invalid_argument);
+    Matrix::set_threads(1);
+    check_equal(Matrix::get_threads(), 1);
+
+    Matrix copy(m1);
+    check(copy == m1);
+    copy[0][0] = -1;
+    check(copy != m1);
+    copy = m1;
+    check(copy == m1);
+    Matrix moved(std::move(copy));
+    check(moved == m1);
+    check_equal(copy.getRows(), 0);
+    copy = std::move(moved);
+    check(copy == m1);
+    check_equal(moved.getColumns(), 0);
+
+    BufferPool buffers;
+    const double *first;
+    {
+        Matrix t(4, 4, &buffers);
+        first = &t[0][0];
+        check_equal(reinterpret_cast<uintptr_t>(first) % BufferPool::ALIGNMENT, 0);
+    }
+    check_equal(buffers.size(), 1);
+    {
+        Matrix t(2, 8, &buffers);
+        check(&t[0][0] == first);
+        check_equal(buffers.size(), 0);
+        Matrix u = t * Matrix(8, 2);
+        check_equal(u.getRows(), 2);
+    }
+    check_equal(buffers.size(), 2);
+
+    Matrix e1(2, 3), e2(2, 3);
+    for (int i = 0; i < 2; ++i)
+        for (int j = 0; j < 3; ++j) {
+            e1[i][j] = i + j;
+            e2[i][j] = i * j;
+        }
+    Matrix e3 = e1 * 2 + e2 - e1;
+    for (int i = 0; i < 2; ++i)
+        for (int j = 0; j < 3; ++j)
+            check_equal(e3[i][j], i + j + i * j);
+    e3 = 0.5 * (e3 - e2) + e1 * 0.5;
+    check(e3 == e1);
+    e3 += e1 * 3;
+    e3 -= e2 + e2;
+    check_equal(e3[1][2], 4 * 3 - 2 * 2);
+    e3 = e3 * 0 + m1;
+    check(e3 == m1);
+    e3 = e1;
+    e3 = e3 + e3;
+    check_equal(e3[1][1], 4);
+    check_throw(e1 + e2 - p1, std::invalid_argument);
+
+    check_equal(m1(1, 2), m1[1][2]);
+    m1(0, 1) = 42;
+    check_equal(m1[0][1], 42);
+    double row_sum = 0;
+    for (double x : m2.row(1))
+        row_sum += x;
+    check_equal(row_sum, m2[1][0] + m2[1][1] + m2[1][2]);
+    check_equal(m2.row(0).size(), 3);
+    m1.row(1)[2] = -1;
+    check_equal(m1[1][2], -1);
+#ifdef MATRIX_DEBUG
+    check_throw(m1(2, 0), std::out_of_range);
+    check_throw(m1.row(0)[3], std::out_of_range);
+#endif
+
+    Matrix dense(4, 5);
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 5; ++j)
+            dense[i][j] = (i + j) % 3 == 0 ? i - j : 0;
+    SparseMatrix sparse(dense);
+    check_equal(sparse.getRows(), 4);
+    check_equal(sparse.getColumns(), 5);
+    check_equal(sparse.nonzeros(), 5);
+    check(sparse.to_dense() == dense);
+    std::vector<double> x { 1, 2, 3, 4, 5 };
+    check(sparse * x == dense * x);
+    Matrix rhs(5, 3);
+    for (int i = 0; i < 5; ++i)
+        for (int j = 0; j < 3; ++j)
+            rhs[i][j] = i * 3 + j;
+    check(sparse * rhs == dense * rhs);
+    check_throw(sparse * dense, std::invalid_argument);
+
+    Matrix p3(400, 210);
+    for (int i = 0; i < 400; ++i)
+        for (int j = 0; j < 210; ++j)
+            p3[i][j] = (i * 7 + j) % 13 - 6;
+    Matrix::set_threads(3);
+    SparseMatrix sp3(p3);
+    std::vector<double> x3(210, 0.5);
+    check(sp3 * x3 == p3 * x3);
+    check(sp3 * p2 == p3 * p2);
+    Matrix::set_threads(1);
+
+    {
+        MatrixFile fa("test_a.mat", 37, 50), fb("test_b.mat", 50, 29);
+        Matrix &a = fa.matrix(), &b = fb.matrix();
+        for (int i = 0; i < 37; ++i)
+            for (int j = 0; j < 50; ++j)
+                a[i][j] = (i * 5 + j) % 11 - 5;
+        for (int i = 0; i < 50; ++i)
+            for (int j = 0; j < 29; ++j)
+                b[i][j] = (i + j * 3) % 7 - 3;
+        MatrixFile fc("test_c.mat", 37, 29);
+        multiply_out_of_core(fc, fa, fb, 3 * 8 * 16 * 16);
+        check(fc.matrix() == a * b);
+        check_throw(multiply_out_of_core(fc, fb, fa, 1 << 20), std::invalid_argument);
+    }
+    {
+        const MatrixFile fa("test_a.mat");
+        check_equal(fa.matrix().getRows(), 37);
+        check_equal(fa.matrix().getColumns(), 50);
+        check_equal(fa.matrix()[3][4], (3 * 5 + 4) % 11 - 5);
+        Matrix copy = fa.matrix();
+        copy *= 2;
+        check_equal(fa.matrix()[3][4] * 2, copy[3][4]);
+    }
+    {
+        MatrixFile fa("test_a.mat", true);
+        const double *mapped = &fa.matrix()[0][0];
+        Matrix twice = fa.matrix() * 2;
+        fa.matrix() = std::move(twice);
+        check(&fa.matrix()[0][0] == mapped);
+        check_throw(fa.matrix() = Matrix(2, 2), std::invalid_argument);
+        check_throw(fa.matrix() = p1 + p1, std::invalid_argument);
+        check_equal(fa.matrix().getRows(), 37);
+    }
+    {
+        /* read-only file is mapped privately */
+        MatrixFile fa("test_a.mat");
+        check_equal(fa.matrix()[3][4], 2 * ((3 * 5 + 4) % 11 - 5));
+        fa.matrix()[3][4] = 100;
+        check_equal(fa.matrix()[3][4], 100);
+    }
+    {
+        const MatrixFile fa("test_a.mat");
+        check_equal(fa.matrix()[3][4], 2 * ((3 * 5 + 4) % 11 - 5));
+    }
+    check_throw(MatrixFile("test_none.mat"), MatrixFileError);
+    {
+        std::FILE *f = std::fopen("test_b.mat", "r+b");
+        std::fputs("XATRIX01", f);
+        std::fclose(f);
+        try {
+            MatrixFile fb("test_b.mat");
+            check(false);
+        }
+        catch (const MatrixFileError &e) {
+            /* no system call failed, so no errno */
+            check(std::string(e.what()).find("errno") == std::string::npos);
+        }
+    }
+    std::remove("test_a.mat");
+    std::remove("test_b.mat");
+    std::remove("test_c.mat");
+
     std::cout << "done\n";
 
     return 0;
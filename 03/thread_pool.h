@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+/* Fixed set of threads running indexed tiles of one job at a time.
+ * Every thread owns a deque of tile indices: it takes tiles from the back
+ * of its own deque and, when that is empty, steals from the front of the
+ * others. The thread calling run() works as thread 0. Concurrent run()
+ * calls take turns; a tile must not call run() on its own pool. */
+class ThreadPool
+{
+    struct alignas(64) Queue
+    {
+        std::mutex lock;
+        std::deque<size_t> tiles;
+    };
+
+    size_t nthreads;
+    std::unique_ptr<Queue[]> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t generation;
+    bool stop;
+
+    /* held by run() for the whole job */
+    std::mutex running;
+    const std::function<void(size_t)> *job;
+    std::atomic<size_t> remaining;
+
+    /* pool whose tiles the current thread is running, if any */
+    static const ThreadPool *&
+    in_tiles()
+    {
+        static thread_local const ThreadPool *p = nullptr;
+        return p;
+    }
+
+    struct TileScope
+    {
+        const ThreadPool *saved;
+
+        explicit TileScope(const ThreadPool *p): saved(in_tiles())
+        {
+            in_tiles() = p;
+        }
+
+        ~TileScope()
+        {
+            in_tiles() = saved;
+        }
+    };
+
+    bool pop(size_t self, size_t &tile)
+    {
+        {
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            if (!queues[self].tiles.empty()) {
+                tile = queues[self].tiles.back();
+                queues[self].tiles.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < nthreads; ++i) {
+            Queue &victim = queues[(self + i) % nthreads];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty()) {
+                tile = victim.tiles.front();
+                victim.tiles.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t self)
+    {
+        TileScope scope(this);
+        size_t tile;
+        while (pop(self, tile)) {
+            (*job)(tile);
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> guard(lock);
+                done.notify_all();
+            }
+        }
+    }
+
+    void worker_loop(size_t self)
+    {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stop || generation != seen; });
+                if (stop)
+                    return;
+                seen = generation;
+            }
+            work(self);
+        }
+    }
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+public:
+    explicit ThreadPool(size_t threads):
+        nthreads(threads ? threads : 1), queues(new Queue[nthreads]),
+        generation(0), stop(false), job(nullptr), remaining(0)
+    {
+        for (size_t i = 1; i < nthreads; ++i)
+            workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+
+    size_t size() const
+    {
+        return nthreads;
+    }
+
+    /* Calls f(0) .. f(ntiles - 1) and returns when all calls are done */
+    void run(size_t ntiles, const std::function<void(size_t)> &f)
+    {
+        if (in_tiles() == this)
+            throw std::logic_error("nested ThreadPool::run");
+        if (nthreads == 1 || ntiles == 1) {
+            TileScope scope(this);
+            for (size_t t = 0; t < ntiles; ++t)
+                f(t);
+            return;
+        }
+
+        std::lock_guard<std::mutex> serial(running);
+        job = &f;
+        remaining = ntiles;
+        /* contiguous ranges of tiles per thread, so neighbours share cache */
+        for (size_t i = 0; i < nthreads; ++i) {
+            std::lock_guard<std::mutex> guard(queues[i].lock);
+            for (size_t t = i * ntiles / nthreads; t < (i + 1) * ntiles / nthreads; ++t)
+                queues[i].tiles.push_back(t);
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return remaining == 0; });
+    }
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <iostream>
+#include <optional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "serializer.h"
+#include "binary.h"
+#include "lz.h"
+#include "crc32c.h"
+
+/* Batched archive: a sequence of chunks, each a header followed by the
+ * payload of records records written by one Archive. A chunk decodes on
+ * its own, so readers can skip it by its header alone, and a reader that
+ * lost its place can find the next chunk by magic and header checksum. */
+struct ChunkHeader
+{
+    char magic[4];
+    uint32_t flags;
+    uint64_t records;
+    /* payload size before and after compression */
+    uint64_t raw_size;
+    uint64_t stored_size;
+    /* CRC32C of stored payload if ChunkChecksum is set, of header before header_crc */
+    uint32_t payload_crc;
+    uint32_t header_crc;
+};
+static_assert(sizeof(ChunkHeader) == 40, "no padding in chunk header");
+
+static constexpr char ChunkMagic[4] = { 'C', 'H', 'N', 'K' };
+static constexpr uint32_t ChunkCompressed = 1;
+static constexpr uint32_t ChunkChecksum = 2;
+/* larger sizes in a header mean it is corrupted */
+static constexpr uint64_t MaxChunkSize = uint64_t(1) << 32;
+
+template <class Archive = BinarySerializer>
+class BatchWriter
+{
+    std::ostream &out_;
+    size_t chunk_size_;
+    bool compress_;
+    bool checksum_;
+    ByteBuffer chunk_;
+    ByteBuffer packed_;
+    std::optional<Archive> archive_;
+    uint64_t records_;
+
+    BatchWriter(const BatchWriter &);
+    BatchWriter &operator=(const BatchWriter &);
+public:
+    /* chunks are flushed once they reach chunk_size bytes */
+    explicit BatchWriter(std::ostream &out, bool compress = false, size_t chunk_size = 1 << 20,
+            bool checksum = true)
+        : out_(out), chunk_size_(chunk_size), compress_(compress), checksum_(checksum),
+          chunk_(chunk_size + chunk_size / 8), packed_(compress ? lz_bound(chunk_size) : 1), records_(0)
+    {
+        archive_.emplace(chunk_);
+    }
+
+    ~BatchWriter()
+    {
+        flush();
+    }
+
+    /* a record that fails to serialize is dropped from the chunk */
+    template <class T>
+    Error save(const T& object)
+    {
+        size_t mark = chunk_.size();
+        Error e = archive_->save(object);
+        if (e != Error::NoError) {
+            chunk_.truncate(mark);
+            return e;
+        }
+        ++records_;
+        if (chunk_.size() >= chunk_size_)
+            flush();
+        return Error::NoError;
+    }
+
+    template <class It>
+    Error save(It begin, It end)
+    {
+        for (; begin != end; ++begin) {
+            Error e = save(*begin);
+            if (e != Error::NoError)
+                return e;
+        }
+        return Error::NoError;
+    }
+
+    /* writes the current chunk, if any, with one call per buffer */
+    void flush()
+    {
+        if (!records_)
+            return;
+        ChunkHeader h;
+        std::memcpy(h.magic, ChunkMagic, sizeof h.magic);
+        h.flags = 0;
+        h.records = records_;
+        h.raw_size = h.stored_size = chunk_.size();
+        const uint8_t *payload = chunk_.data();
+        if (compress_) {
+            packed_.clear();
+            size_t n = lz_compress(chunk_.data(), chunk_.size(), packed_);
+            if (n < chunk_.size()) {
+                h.flags = ChunkCompressed;
+                h.stored_size = n;
+                payload = packed_.data();
+            }
+        }
+        h.payload_crc = 0;
+        if (checksum_) {
+            h.flags |= ChunkChecksum;
+            h.payload_crc = crc32c(0, payload, h.stored_size);
+        }
+        h.header_crc = crc32c(0, &h, offsetof(ChunkHeader, header_crc));
+        out_.write(reinterpret_cast<const char *>(&h), sizeof h);
+        out_.write(reinterpret_cast<const char *>(payload), h.stored_size);
+        chunk_.clear();
+        records_ = 0;
+        archive_.emplace(chunk_);
+    }
+};
+
+/* Strict readers fail on the first bad chunk. Resilient ones record the
+ * stream offset of the bad chunk, search forward for the next valid
+ * chunk header and go on from there; the stream must be seekable. */
+template <class Archive = BinaryDeserializer>
+class BatchReader
+{
+    std::istream &in_;
+    bool resilient_;
+    ChunkHeader header_;
+    ByteBuffer stored_;
+    ByteBuffer raw_;
+    std::optional<Archive> archive_;
+    /* records not yet loaded from the current chunk */
+    uint64_t left_;
+    /* stream offset of the current chunk */
+    std::streamoff offset_;
+    std::vector<uint64_t> corrupted_;
+
+    BatchReader(const BatchReader &);
+    BatchReader &operator=(const BatchReader &);
+
+    bool valid_header() const
+    {
+        const ChunkHeader &h = header_;
+        return !std::memcmp(h.magic, ChunkMagic, sizeof h.magic) &&
+            h.header_crc == crc32c(0, &h, offsetof(ChunkHeader, header_crc)) &&
+            h.raw_size <= MaxChunkSize && h.stored_size <= MaxChunkSize &&
+            !(h.flags & ~(ChunkCompressed | ChunkChecksum)) &&
+            ((h.flags & ChunkCompressed) || h.stored_size == h.raw_size);
+    }
+
+    Error read_header()
+    {
+        offset_ = in_.tellg();
+        if (!in_.read(reinterpret_cast<char *>(&header_), sizeof header_) || !valid_header())
+            return Error::CorruptedArchive;
+        return Error::NoError;
+    }
+
+    /* positions the stream at the next valid header after the bad chunk
+     * at offset_, or at its end */
+    void resync()
+    {
+        corrupted_.push_back(offset_);
+        left_ = 0;
+        std::streamoff at = offset_ + 1;
+        for (;;) {
+            in_.clear();
+            in_.seekg(at);
+            /* look for the magic byte by byte, then check the whole header */
+            size_t matched = 0;
+            int c;
+            while (matched < sizeof ChunkMagic && (c = in_.get()) != std::istream::traits_type::eof())
+                matched = c == ChunkMagic[matched] ? matched + 1 : c == ChunkMagic[0];
+            if (matched < sizeof ChunkMagic)
+                return;
+            at = std::streamoff(in_.tellg()) - std::streamoff(sizeof ChunkMagic);
+            in_.seekg(at);
+            if (in_.read(reinterpret_cast<char *>(&header_), sizeof header_) && valid_header()) {
+                in_.seekg(at);
+                return;
+            }
+            ++at;
+        }
+    }
+
+    Error read_chunk()
+    {
+        Error e = read_header();
+        if (e != Error::NoError)
+            return e;
+        stored_.clear();
+        if (!in_.read(reinterpret_cast<char *>(stored_.reserve(header_.stored_size)), header_.stored_size))
+            return Error::CorruptedArchive;
+        stored_.commit(header_.stored_size);
+        if ((header_.flags & ChunkChecksum) &&
+                crc32c(0, stored_.data(), stored_.size()) != header_.payload_crc)
+            return Error::CorruptedArchive;
+        const ByteBuffer *payload = &stored_;
+        if (header_.flags & ChunkCompressed) {
+            raw_.clear();
+            if (!lz_decompress(stored_.data(), stored_.size(), raw_.reserve(header_.raw_size), header_.raw_size))
+                return Error::CorruptedArchive;
+            raw_.commit(header_.raw_size);
+            payload = &raw_;
+        }
+        archive_.emplace(*payload);
+        left_ = header_.records;
+        return Error::NoError;
+    }
+public:
+    explicit BatchReader(std::istream &in, bool resilient = false)
+        : in_(in), resilient_(resilient), left_(0), offset_(0)
+    {
+    }
+
+    /* stream offsets of chunks skipped by a resilient reader */
+    const std::vector<uint64_t> &corrupted() const
+    {
+        return corrupted_;
+    }
+
+    /* true when the stream has no more records */
+    bool done()
+    {
+        return !left_ && in_.peek() == std::istream::traits_type::eof();
+    }
+
+    template <class T>
+    Error load(T& object)
+    {
+        for (;;) {
+            while (!left_) {
+                if (in_.peek() == std::istream::traits_type::eof())
+                    return Error::CorruptedArchive;
+                Error e = read_chunk();
+                if (e == Error::NoError)
+                    continue;
+                if (!resilient_)
+                    return e;
+                resync();
+            }
+            --left_;
+            Error e = archive_->load(object);
+            if (e == Error::NoError || !resilient_)
+                return e;
+            /* checksum passed but records do not decode: drop the chunk */
+            in_.clear();
+            in_.seekg(offset_ + std::streamoff(sizeof header_ + header_.stored_size));
+            corrupted_.push_back(offset_);
+            left_ = 0;
+        }
+    }
+
+    /* drops the rest of the current chunk, or the next chunk unread
+     * if the current one is finished; skipped is set to record count */
+    Error skip_chunk(uint64_t &skipped)
+    {
+        skipped = left_;
+        if (left_) {
+            left_ = 0;
+            return Error::NoError;
+        }
+        Error e = read_header();
+        if (e != Error::NoError)
+            return e;
+        if (!in_.ignore(header_.stored_size) || uint64_t(in_.gcount()) != header_.stored_size)
+            return Error::CorruptedArchive;
+        skipped = header_.records;
+        return Error::NoError;
+    }
+};
@@ -0,0 +1,425 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <string_view>
+
+#include "serializer.h"
+#include "binary.h"
+#include "view.h"
+#include "record.h"
+#include "batch.h"
+
+struct Data
+{
+    uint64_t a;
+    bool b;
+    uint64_t c;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(a, b, c);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(a, b, c);
+    }
+};
+
+template <class F>
+double
+seconds(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<Data>
+records(size_t n)
+{
+    /* mix of small counters and full width values */
+    std::mt19937_64 gen(42);
+    std::vector<Data> v(n);
+    for (auto &d : v) {
+        d.a = gen() % 1000;
+        d.b = gen() & 1;
+        d.c = gen() >> (gen() % 64);
+    }
+    return v;
+}
+
+bool
+same(const std::vector<Data> &x, const std::vector<Data> &y)
+{
+    for (size_t i = 0; i < x.size(); ++i)
+        if (x[i].a != y[i].a || x[i].b != y[i].b || x[i].c != y[i].c)
+            return false;
+    return true;
+}
+
+void
+report(const char *format, size_t n, size_t bytes, double save, double load)
+{
+    std::cout << format << '\t' << double(bytes) / n << '\t'
+              << bytes / save / 1e6 << '\t' << bytes / load / 1e6 << '\t'
+              << n / save / 1e6 << '\t' << n / load / 1e6 << std::endl;
+}
+
+/* Text and binary archives of n Data records */
+int
+bench_format(size_t n)
+{
+    std::vector<Data> src = records(n), dst(n);
+    std::cout << "format\tbytes_per_record\tsave_mb_s\tload_mb_s\tsave_mrec_s\tload_mrec_s" << std::endl;
+
+    std::stringstream stream;
+    Serializer text(stream);
+    /* text records are not self-delimiting, separate them */
+    double save = seconds([&] {
+        for (auto &d : src) {
+            text.save(d);
+            stream << Separator;
+        }
+    });
+    size_t bytes = stream.str().size();
+    Deserializer text_reader(stream);
+    double load = seconds([&] {
+        for (auto &d : dst)
+            text_reader.load(d);
+    });
+    if (!same(src, dst)) {
+        std::cerr << "text mismatch" << std::endl;
+        return 1;
+    }
+    report("text", n, bytes, save, load);
+
+    ByteBuffer buffer;
+    BinarySerializer binary(buffer);
+    save = seconds([&] {
+        for (auto &d : src)
+            binary.save(d);
+    });
+    dst.assign(n, Data { 0, false, 0 });
+    BinaryDeserializer binary_reader(buffer);
+    load = seconds([&] {
+        for (auto &d : dst)
+            binary_reader.load(d);
+    });
+    if (!same(src, dst)) {
+        std::cerr << "binary mismatch" << std::endl;
+        return 1;
+    }
+    report("binary", n, buffer.size(), save, load);
+    return 0;
+}
+
+/* Data records through varint fields and through fixed layout */
+int
+bench_record(size_t n)
+{
+    std::vector<Data> src = records(n), dst(n);
+    std::cout << "format\tbytes_per_record\tsave_mb_s\tload_mb_s\tsave_mrec_s\tload_mrec_s" << std::endl;
+
+    ByteBuffer buffer;
+    BinarySerializer binary(buffer);
+    double save = seconds([&] {
+        for (auto &d : src)
+            binary.save(d);
+    });
+    BinaryDeserializer binary_reader(buffer);
+    double load = seconds([&] {
+        for (auto &d : dst)
+            binary_reader.load(d);
+    });
+    if (!same(src, dst)) {
+        std::cerr << "binary mismatch" << std::endl;
+        return 1;
+    }
+    report("binary", n, buffer.size(), save, load);
+
+    ByteBuffer record_buffer;
+    RecordSerializer record(record_buffer);
+    save = seconds([&] {
+        for (auto &d : src)
+            record.save(d);
+    });
+    dst.assign(n, Data { 0, false, 0 });
+    RecordDeserializer record_reader(record_buffer);
+    load = seconds([&] {
+        for (auto &d : dst)
+            record_reader.load(d);
+    });
+    if (!same(src, dst)) {
+        std::cerr << "record mismatch" << std::endl;
+        return 1;
+    }
+    report("record", n, record_buffer.size(), save, load);
+    return 0;
+}
+
+/* Data records to a file: text fields per save, one write per binary
+ * record, and batched chunks with and without compression */
+int
+bench_batch(size_t n)
+{
+    const char *filename = "bench.batch";
+    std::vector<Data> src = records(n), dst(n);
+    /* repeated values as in counters and flags of real dumps */
+    for (size_t i = 0; i < n; ++i)
+        src[i].a = i / 16;
+    std::cout << "mode\tfile_bytes\tsave_mrec_s\tload_mrec_s" << std::endl;
+
+    auto file_size = [&] {
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        return size_t(in.tellg());
+    };
+
+    double save = seconds([&] {
+        std::ofstream out(filename, std::ios::binary);
+        Serializer text(out);
+        for (auto &d : src) {
+            text.save(d);
+            out << Separator;
+        }
+    });
+    std::cout << "text\t" << file_size() << '\t' << n / save / 1e6 << "\t-" << std::endl;
+
+    save = seconds([&] {
+        std::ofstream out(filename, std::ios::binary);
+        ByteBuffer buffer(64);
+        BinarySerializer binary(buffer);
+        for (auto &d : src) {
+            buffer.clear();
+            binary.save(d);
+            out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+        }
+    });
+    std::cout << "record_writes\t" << file_size() << '\t' << n / save / 1e6 << "\t-" << std::endl;
+
+    /* unchecked chunks, then CRC32C checked ones read strictly and resiliently */
+    struct Mode { const char *name; bool compress, checksum, resilient; };
+    for (Mode m : { Mode { "batch", false, false, false }, Mode { "batch_crc", false, true, false },
+            Mode { "batch_crc_resilient", false, true, true }, Mode { "batch_lz", true, false, false },
+            Mode { "batch_lz_crc", true, true, false } }) {
+        save = seconds([&] {
+            std::ofstream out(filename, std::ios::binary);
+            BatchWriter<> writer(out, m.compress, 1 << 20, m.checksum);
+            writer.save(src.begin(), src.end());
+        });
+        dst.assign(n, Data { 0, false, 0 });
+        double load = seconds([&] {
+            std::ifstream in(filename, std::ios::binary);
+            BatchReader<> reader(in, m.resilient);
+            for (auto &d : dst)
+                reader.load(d);
+        });
+        if (!same(src, dst)) {
+            std::cerr << m.name << " mismatch" << std::endl;
+            return 1;
+        }
+        std::cout << m.name << '\t' << file_size() << '\t'
+                  << n / save / 1e6 << '\t' << n / load / 1e6 << std::endl;
+    }
+    std::remove(filename);
+    return 0;
+}
+
+struct Samples
+{
+    std::vector<uint64_t> values;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(values);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(values);
+    }
+};
+
+/* One vector of n numbers: block copies through a stream and into a buffer */
+int
+bench_vector(size_t n, size_t iters)
+{
+    Samples src, dst;
+    std::mt19937_64 gen(42);
+    src.values.resize(n);
+    for (auto &x : src.values)
+        x = gen();
+    std::cout << "format\tbytes_per_record\tsave_mb_s\tload_mb_s\tsave_mrec_s\tload_mrec_s" << std::endl;
+
+    std::string text;
+    double save = seconds([&] {
+        for (size_t i = 0; i < iters; ++i) {
+            std::ostringstream stream;
+            Serializer(stream).save(src);
+            text = stream.str();
+        }
+    });
+    double load = seconds([&] {
+        for (size_t i = 0; i < iters; ++i) {
+            std::istringstream stream(text);
+            Deserializer(stream).load(dst);
+        }
+    });
+    if (src.values != dst.values) {
+        std::cerr << "text mismatch" << std::endl;
+        return 1;
+    }
+    report("text", iters, text.size() * iters, save, load);
+
+    ByteBuffer buffer;
+    save = seconds([&] {
+        for (size_t i = 0; i < iters; ++i) {
+            buffer.clear();
+            BinarySerializer(buffer).save(src);
+        }
+    });
+    dst.values.clear();
+    load = seconds([&] {
+        for (size_t i = 0; i < iters; ++i)
+            BinaryDeserializer(buffer).load(dst);
+    });
+    if (src.values != dst.values) {
+        std::cerr << "binary mismatch" << std::endl;
+        return 1;
+    }
+    report("binary", iters, buffer.size() * iters, save, load);
+    return 0;
+}
+
+struct Series
+{
+    std::string name;
+    std::vector<double> values;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(name, values);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(name, values);
+    }
+};
+
+struct SeriesView
+{
+    std::string_view name;
+    Span<double> values;
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(name, values);
+    }
+};
+
+/* Reads every record of the mapping, touching one value of each */
+template <class Record>
+double
+read_archive(const MappedArchive &file, size_t &records, double &sum)
+{
+    return seconds([&] {
+        ViewDeserializer reader(file.data(), file.size());
+        Record r;
+        records = 0;
+        sum = 0;
+        while (!reader.done()) {
+            if (reader.load(r) != Error::NoError) {
+                records = 0;
+                return;
+            }
+            sum += r.values[records % r.values.size()];
+            ++records;
+        }
+    });
+}
+
+/* Aligned archive of about mb megabytes in a file, read by copying
+ * fields out of the mapping and by views into it; both validate the
+ * same lengths, views skip the payload */
+int
+bench_view(size_t mb, size_t values)
+{
+    const char *filename = "bench.archive";
+    size_t n = 0;
+    {
+        Series s { "series", std::vector<double>(values) };
+        std::mt19937_64 gen(42);
+        ByteBuffer buffer(mb << 20);
+        AlignedSerializer writer(buffer);
+        while (buffer.size() < mb << 20) {
+            s.name.resize(8 + gen() % 16, 'a' + n % 26);
+            for (auto &x : s.values)
+                x = double(gen() % 1000);
+            writer.save(s);
+            ++n;
+        }
+        FILE *f = std::fopen(filename, "wb");
+        if (!f || std::fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size() || std::fclose(f)) {
+            std::cerr << "can't write " << filename << std::endl;
+            return 1;
+        }
+    }
+
+    MappedArchive file(filename);
+    size_t records;
+    double sum, view_sum;
+    read_archive<SeriesView>(file, records, view_sum);
+    double copy = read_archive<Series>(file, records, sum);
+    size_t copy_records = records;
+    double view = read_archive<SeriesView>(file, records, view_sum);
+    std::remove(filename);
+    if (records != n || copy_records != n || sum != view_sum) {
+        std::cerr << "mismatch" << std::endl;
+        return 1;
+    }
+
+    std::cout << "mode\tarchive_mb\trecords\tsec\tmb_s" << std::endl;
+    std::cout << "copy\t" << file.size() / 1e6 << '\t' << n << '\t' << copy << '\t' << file.size() / copy / 1e6 << std::endl;
+    std::cout << "view\t" << file.size() / 1e6 << '\t' << n << '\t' << view << '\t' << file.size() / view / 1e6 << std::endl;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "format")
+        return bench_format(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000);
+    if (mode == "record")
+        return bench_record(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
+    if (mode == "batch")
+        return bench_batch(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
+    if (mode == "vector")
+        return bench_vector(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10);
+    if (mode == "view")
+        return bench_view(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 64);
+
+    std::cerr << "Usage: bench format [records]" << std::endl;
+    std::cerr << "       bench record [records]" << std::endl;
+    std::cerr << "       bench batch [records]" << std::endl;
+    std::cerr << "       bench vector [elements] [iterations]" << std::endl;
+    std::cerr << "       bench view [archive_mb] [values_per_record]" << std::endl;
+    return 1;
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "serializer.h"
+
+/* Growable byte buffer; writers reserve room, fill it through the
+ * returned pointer and commit the number of bytes actually written */
+class ByteBuffer
+{
+    uint8_t *data_;
+    size_t size_;
+    size_t capacity_;
+
+    ByteBuffer(const ByteBuffer &);
+    ByteBuffer &operator=(const ByteBuffer &);
+public:
+    explicit ByteBuffer(size_t capacity = 4096)
+        : data_(nullptr), size_(0), capacity_(0)
+    {
+        grow(capacity);
+    }
+
+    ByteBuffer(ByteBuffer &&b) noexcept
+        : data_(b.data_), size_(b.size_), capacity_(b.capacity_)
+    {
+        b.data_ = nullptr;
+        b.size_ = b.capacity_ = 0;
+    }
+
+    ByteBuffer &operator=(ByteBuffer &&b) noexcept
+    {
+        std::swap(data_, b.data_);
+        std::swap(size_, b.size_);
+        std::swap(capacity_, b.capacity_);
+        return *this;
+    }
+
+    ~ByteBuffer()
+    {
+        std::free(data_);
+    }
+
+    uint8_t *reserve(size_t n)
+    {
+        if (capacity_ - size_ < n)
+            grow(std::max(capacity_ * 2, size_ + n));
+        return data_ + size_;
+    }
+
+    void commit(size_t n)
+    {
+        size_ += n;
+    }
+
+    void append(const void *p, size_t n)
+    {
+        if (n)
+            std::memcpy(reserve(n), p, n);
+        size_ += n;
+    }
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+    /* drops bytes past n */
+    void truncate(size_t n)
+    {
+        if (n < size_)
+            size_ = n;
+    }
+
+    uint8_t *data() { return data_; }
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    void grow(size_t capacity)
+    {
+        if (!capacity)
+            return;
+        void *p = std::realloc(data_, capacity);
+        if (!p)
+            throw std::bad_alloc();
+        data_ = static_cast<uint8_t *>(p);
+        capacity_ = capacity;
+    }
+};
+
+/* LEB128: 7 bits per byte, low groups first, high bit set on all but
+ * the last byte; at most 10 bytes for uint64_t */
+static constexpr size_t MaxVarintSize = 10;
+
+inline size_t put_varint(uint8_t *p, uint64_t x)
+{
+    size_t n = 0;
+    while (x >= 0x80) {
+        p[n++] = uint8_t(x) | 0x80;
+        x >>= 7;
+    }
+    p[n++] = uint8_t(x);
+    return n;
+}
+
+/* Binary archive: varint integers and one byte bools, no separators;
+ * strings and vectors are prefixed with varint length */
+class BinarySerializer
+{
+    ByteBuffer &out_;
+public:
+    explicit BinarySerializer(ByteBuffer &out)
+        : out_(out)
+    {
+    }
+
+    template <class T>
+    Error save(const T& object)
+    {
+        return object.serialize(*this);
+    }
+
+    template <class... ArgsT>
+    Error operator()(ArgsT&&... args)
+    {
+        return process(std::forward<ArgsT>(args)...);
+    }
+
+private:
+    Error write(bool arg)
+    {
+        *out_.reserve(1) = arg;
+        out_.commit(1);
+        return Error::NoError;
+    }
+
+    Error write(uint64_t arg)
+    {
+        out_.commit(put_varint(out_.reserve(MaxVarintSize), arg));
+        return Error::NoError;
+    }
+
+    Error write(const std::string &arg)
+    {
+        write(uint64_t(arg.size()));
+        out_.append(arg.data(), arg.size());
+        return Error::NoError;
+    }
+
+    template <class It>
+    Error write_elements(It begin, It end)
+    {
+        for (; begin != end; ++begin) {
+            Error e = write(*begin);
+            if (e != Error::NoError)
+                return e;
+        }
+        return Error::NoError;
+    }
+
+    template <class T>
+    Error write(const std::vector<T> &arg)
+    {
+        write(uint64_t(arg.size()));
+        if constexpr (is_bulk<T>) {
+            out_.append(arg.data(), arg.size() * sizeof(T));
+            return Error::NoError;
+        } else {
+            return write_elements(arg.begin(), arg.end());
+        }
+    }
+
+    template <class T, size_t N>
+    Error write(const std::array<T, N> &arg)
+    {
+        if constexpr (is_bulk<T>) {
+            out_.append(arg.data(), N * sizeof(T));
+            return Error::NoError;
+        } else {
+            return write_elements(arg.begin(), arg.end());
+        }
+    }
+
+    template <class K, class V, class C>
+    Error write(const std::map<K, V, C> &arg)
+    {
+        write(uint64_t(arg.size()));
+        for (const auto &x : arg) {
+            Error e = process(x.first, x.second);
+            if (e != Error::NoError)
+                return e;
+        }
+        return Error::NoError;
+    }
+
+    template <class T>
+    auto write(const T &arg) -> decltype(arg.serialize(*this))
+    {
+        return arg.serialize(*this);
+    }
+
+    template <class T>
+    Error process(T&& arg)
+    {
+        return write(arg);
+    }
+
+    template <class T, class... ArgsT>
+    Error process(T&& arg, ArgsT&&... args)
+    {
+        Error e = write(arg);
+        if (e == Error::NoError)
+            return process(std::forward<ArgsT>(args)...);
+        return e;
+    }
+};
+
+class BinaryDeserializer
+{
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_;
+public:
+    BinaryDeserializer(const uint8_t *data, size_t size)
+        : data_(data), size_(size), pos_(0)
+    {
+    }
+
+    explicit BinaryDeserializer(const ByteBuffer &in)
+        : BinaryDeserializer(in.data(), in.size())
+    {
+    }
+
+    template <class T>
+    Error load(T& object)
+    {
+        return object.deserialize(*this);
+    }
+
+    template <class... ArgsT>
+    Error operator()(ArgsT&... args)
+    {
+        return process(args...);
+    }
+
+    /* bytes consumed so far */
+    size_t position() const { return pos_; }
+
+private:
+    size_t remaining() const
+    {
+        return size_ - pos_;
+    }
+
+    Error read(bool &arg)
+    {
+        if (pos_ == size_ || data_[pos_] > 1)
+            return Error::CorruptedArchive;
+        arg = data_[pos_++];
+        return Error::NoError;
+    }
+
+    Error read(uint64_t &arg)
+    {
+        uint64_t x = 0;
+        for (unsigned shift = 0; shift < 64 && pos_ < size_; shift += 7) {
+            uint8_t b = data_[pos_++];
+            x |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                /* only one bit of the tenth byte fits */
+                if (shift == 63 && b > 1)
+                    return Error::CorruptedArchive;
+                arg = x;
+                return Error::NoError;
+            }
+        }
+        return Error::CorruptedArchive;
+    }
+
+    /* element count that cannot exceed the rest of the archive */
+    Error read_size(uint64_t &n, size_t element_size)
+    {
+        Error e = read(n);
+        if (e == Error::NoError && element_size && n > remaining() / element_size)
+            return Error::CorruptedArchive;
+        return e;
+    }
+
+    Error read(std::string &arg)
+    {
+        uint64_t n;
+        Error e = read_size(n, 1);
+        if (e != Error::NoError)
+            return e;
+        arg.assign(reinterpret_cast<const char *>(data_ + pos_), n);
+        pos_ += n;
+        return Error::NoError;
+    }
+
+    template <class T>
+    Error read(std::vector<T> &arg)
+    {
+        uint64_t n;
+        if constexpr (is_bulk<T>) {
+            Error e = read_size(n, sizeof(T));
+            if (e != Error::NoError)
+                return e;
+            arg.resize(n);
+            if (n)
+                std::memcpy(arg.data(), data_ + pos_, n * sizeof(T));
+            pos_ += n * sizeof(T);
+            return Error::NoError;
+        } else {
+            /* elements take at least a byte unless they are empty structs */
+            Error e = read(n);
+            if (e != Error::NoError)
+                return e;
+            arg.clear();
+            arg.reserve(std::min<uint64_t>(n, remaining()));
+            for (uint64_t i = 0; i < n; ++i) {
+                T x;
+                if ((e = read(x)) != Error::NoError)
+                    return e;
+                arg.push_back(std::move(x));
+            }
+            return Error::NoError;
+        }
+    }
+
+    template <class T, size_t N>
+    Error read(std::array<T, N> &arg)
+    {
+        if constexpr (is_bulk<T>) {
+            if (remaining() < N * sizeof(T))
+                return Error::CorruptedArchive;
+            std::memcpy(arg.data(), data_ + pos_, N * sizeof(T));
+            pos_ += N * sizeof(T);
+            return Error::NoError;
+        } else {
+            for (auto &x : arg) {
+                Error e = read(x);
+                if (e != Error::NoError)
+                    return e;
+            }
+            return Error::NoError;
+        }
+    }
+
+    template <class K, class V, class C>
+    Error read(std::map<K, V, C> &arg)
+    {
+        uint64_t n;
+        Error e = read(n);
+        if (e != Error::NoError)
+            return e;
+        arg.clear();
+        for (uint64_t i = 0; i < n; ++i) {
+            K key;
+            V value;
+            if ((e = process(key, value)) != Error::NoError)
+                return e;
+            if (!arg.emplace(std::move(key), std::move(value)).second)
+                return Error::CorruptedArchive;
+        }
+        return Error::NoError;
+    }
+
+    template <class T>
+    auto read(T &arg) -> decltype(arg.deserialize(*this))
+    {
+        return arg.deserialize(*this);
+    }
+
+    template <class T>
+    Error process(T &arg)
+    {
+        return read(arg);
+    }
+
+    template <class T, class... ArgsT>
+    Error process(T &arg, ArgsT&... args)
+    {
+        Error e = read(arg);
+        if (e == Error::NoError)
+            return process(args...);
+        return e;
+    }
+};
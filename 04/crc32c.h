@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+/* CRC32 instruction is picked at run time on x86-64, so builds without
+ * -msse4.2 get it too; -msse4.2 drops the check */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE 1
+#endif
+
+/* CRC-32C (Castagnoli, reflected polynomial 0x82f63b78) as used by iSCSI
+ * and ext4; crc32c(0, "123456789", 9) == 0xe3069283. Calls chain: pass
+ * the previous result to continue a checksum. */
+static constexpr uint32_t Crc32cPoly = 0x82f63b78;
+
+/* slicing by 8: t[k][b] is the CRC of byte b followed by k zero bytes */
+constexpr std::array<std::array<uint32_t, 256>, 8> crc32c_table()
+{
+    std::array<std::array<uint32_t, 256>, 8> t {};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? c >> 1 ^ Crc32cPoly : c >> 1;
+        t[0][i] = c;
+    }
+    for (size_t k = 1; k < 8; ++k)
+        for (uint32_t i = 0; i < 256; ++i)
+            t[k][i] = t[k - 1][i] >> 8 ^ t[0][t[k - 1][i] & 0xff];
+    return t;
+}
+
+static constexpr std::array<std::array<uint32_t, 256>, 8> Crc32cTable = crc32c_table();
+
+/* both kernels take and return the inverted CRC */
+inline uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t n)
+{
+    const auto &t = Crc32cTable;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24);
+        crc = t[7][lo & 0xff] ^ t[6][lo >> 8 & 0xff] ^ t[5][lo >> 16 & 0xff] ^ t[4][lo >> 24] ^
+            t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    for (; n; --n)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ crc >> 8;
+    return crc;
+}
+
+#ifdef CRC32C_HARDWARE
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof v);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = uint32_t(c);
+    for (; n; --n)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+inline bool crc32c_has_sse42()
+{
+#ifdef __SSE4_2__
+    return true;
+#else
+    static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+    return has;
+#endif
+}
+#endif
+
+inline uint32_t crc32c(uint32_t crc, const void *data, size_t n)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+#ifdef CRC32C_HARDWARE
+    if (crc32c_has_sse42())
+        return ~crc32c_sse42(~crc, p, n);
+#endif
+    return ~crc32c_table(~crc, p, n);
+}
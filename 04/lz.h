@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "binary.h"
+
+/* Byte-oriented LZ77 in the spirit of LZ4. Input is a list of sequences:
+ * token with literal count in the high nibble and match length minus
+ * LzMinMatch in the low one, 15 meaning more length bytes follow (each
+ * added, 255 meaning one more), literals, then 2-byte little-endian match
+ * offset and match length bytes. The last sequence ends after its literals. */
+static constexpr size_t LzMinMatch = 4;
+static constexpr size_t LzMaxOffset = 65535;
+static constexpr unsigned LzHashBits = 14;
+
+inline size_t lz_bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+inline uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = uint8_t(len);
+    return op;
+}
+
+/* appends compressed src to out, returns compressed size */
+inline size_t lz_compress(const uint8_t *src, size_t n, ByteBuffer &out)
+{
+    uint8_t *const begin = out.reserve(lz_bound(n));
+    uint8_t *op = begin;
+    /* positions + 1 of recent 4-byte sequences, 0 when empty */
+    static thread_local uint32_t table[1 << LzHashBits];
+    std::memset(table, 0, sizeof table);
+
+    size_t anchor = 0, i = 0;
+    auto emit = [&](size_t literals, size_t offset, size_t match) {
+        size_t m = match ? match - LzMinMatch : 0;
+        *op++ = uint8_t((literals < 15 ? literals : 15) << 4 | (m < 15 ? m : 15));
+        if (literals >= 15)
+            op = lz_put_length(op, literals - 15);
+        if (literals)
+            std::memcpy(op, src + anchor, literals);
+        op += literals;
+        if (!match)
+            return;
+        *op++ = uint8_t(offset);
+        *op++ = uint8_t(offset >> 8);
+        if (m >= 15)
+            op = lz_put_length(op, m - 15);
+    };
+
+    while (n >= LzMinMatch && i <= n - LzMinMatch) {
+        uint32_t v;
+        std::memcpy(&v, src + i, sizeof v);
+        uint32_t h = (v * 2654435761u) >> (32 - LzHashBits);
+        size_t candidate = table[h];
+        table[h] = uint32_t(i + 1);
+        if (!candidate || i - (candidate - 1) > LzMaxOffset ||
+                std::memcmp(src + candidate - 1, src + i, LzMinMatch)) {
+            ++i;
+            continue;
+        }
+        size_t c = candidate - 1, len = LzMinMatch;
+        while (i + len < n && src[c + len] == src[i + len])
+            ++len;
+        emit(i - anchor, i - c, len);
+        i += len;
+        anchor = i;
+    }
+    emit(n - anchor, 0, 0);
+    out.commit(op - begin);
+    return op - begin;
+}
+
+inline bool lz_get_length(const uint8_t *&ip, const uint8_t *end, size_t &len)
+{
+    uint8_t b;
+    do {
+        if (ip == end)
+            return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+/* false unless src decodes to exactly size bytes */
+inline bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size)
+{
+    const uint8_t *ip = src, *const iend = src + n;
+    uint8_t *op = dst, *const oend = dst + size;
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !lz_get_length(ip, iend, literals))
+            return false;
+        if (size_t(iend - ip) < literals || size_t(oend - op) < literals)
+            return false;
+        if (literals)
+            std::memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = ip[0] | size_t(ip[1]) << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !lz_get_length(ip, iend, match))
+            return false;
+        match += LzMinMatch;
+        if (!offset || offset > size_t(op - dst) || size_t(oend - op) < match)
+            return false;
+        /* overlapping copy repeats the last offset bytes */
+        const uint8_t *from = op - offset;
+        if (offset >= match)
+            std::memcpy(op, from, match);
+        else
+            for (size_t k = 0; k < match; ++k)
+                op[k] = from[k];
+        op += match;
+    }
+    return op == oend;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "serializer.h"
+#include "binary.h"
+
+/* Records whose fields are all numbers or bools have a layout known at
+ * compile time: fields are packed back to back in host byte order, so a
+ * record is one block of fixed size written and read with no branches
+ * per field. The archive starts with a header holding a hash of the
+ * field types; readers with a different field list get SchemaMismatch
+ * before touching any record. */
+template <class T>
+constexpr bool is_record_field = std::is_arithmetic<T>::value;
+
+template <class... T>
+struct RecordLayout
+{
+    static_assert((is_record_field<T> && ...), "record fields must be numbers or bools");
+
+    static constexpr size_t size = (sizeof(T) + ... + 0);
+
+    static constexpr std::array<size_t, sizeof...(T)> offsets()
+    {
+        std::array<size_t, sizeof...(T)> o {};
+        const size_t sizes[] = { sizeof(T)..., 0 };
+        size_t at = 0;
+        for (size_t i = 0; i < sizeof...(T); ++i) {
+            o[i] = at;
+            at += sizes[i];
+        }
+        return o;
+    }
+
+    /* FNV-1a over kind and size of every field */
+    static constexpr uint64_t schema()
+    {
+        const uint64_t codes[] = { field_code<T>()..., 0 };
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof...(T); ++i) {
+            h ^= codes[i];
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+private:
+    template <class F>
+    static constexpr uint64_t field_code()
+    {
+        uint64_t kind = std::is_same<F, bool>::value ? 1 :
+            std::is_floating_point<F>::value ? 2 :
+            std::is_signed<F>::value ? 3 : 4;
+        return kind << 8 | sizeof(F);
+    }
+};
+
+struct RecordHeader
+{
+    char magic[8];
+    uint64_t schema;
+};
+
+static constexpr char RecordMagic[8] = { 'R', 'E', 'C', 'O', 'R', 'D', '0', '1' };
+
+class RecordSerializer
+{
+    ByteBuffer &out_;
+    uint64_t schema_;
+    bool started_;
+public:
+    explicit RecordSerializer(ByteBuffer &out)
+        : out_(out), schema_(0), started_(false)
+    {
+    }
+
+    template <class T>
+    Error save(const T& object)
+    {
+        return object.serialize(*this);
+    }
+
+    /* header goes before the first record; every record of the archive
+     * must have the same field list */
+    template <class... ArgsT>
+    Error operator()(const ArgsT&... args)
+    {
+        using Layout = RecordLayout<ArgsT...>;
+        constexpr uint64_t schema = Layout::schema();
+        if (!started_) {
+            RecordHeader h;
+            std::memcpy(h.magic, RecordMagic, sizeof h.magic);
+            h.schema = schema_ = schema;
+            out_.append(&h, sizeof h);
+            started_ = true;
+        } else if (schema_ != schema) {
+            return Error::SchemaMismatch;
+        }
+        store(out_.reserve(Layout::size), std::index_sequence_for<ArgsT...>(), args...);
+        out_.commit(Layout::size);
+        return Error::NoError;
+    }
+
+private:
+    template <size_t... I, class... ArgsT>
+    static void store(uint8_t *p, std::index_sequence<I...>, const ArgsT&... args)
+    {
+        constexpr auto offsets = RecordLayout<ArgsT...>::offsets();
+        (std::memcpy(p + offsets[I], &args, sizeof(ArgsT)), ...);
+    }
+};
+
+class RecordDeserializer
+{
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_;
+    uint64_t schema_;
+public:
+    RecordDeserializer(const uint8_t *data, size_t size)
+        : data_(data), size_(size), pos_(0), schema_(0)
+    {
+    }
+
+    explicit RecordDeserializer(const ByteBuffer &in)
+        : RecordDeserializer(in.data(), in.size())
+    {
+    }
+
+    template <class T>
+    Error load(T& object)
+    {
+        return object.deserialize(*this);
+    }
+
+    template <class... ArgsT>
+    Error operator()(ArgsT&... args)
+    {
+        using Layout = RecordLayout<ArgsT...>;
+        constexpr uint64_t schema = Layout::schema();
+        if (!pos_) {
+            RecordHeader h;
+            if (size_ < sizeof h)
+                return Error::CorruptedArchive;
+            std::memcpy(&h, data_, sizeof h);
+            if (std::memcmp(h.magic, RecordMagic, sizeof h.magic))
+                return Error::CorruptedArchive;
+            if (h.schema != schema)
+                return Error::SchemaMismatch;
+            pos_ = sizeof h;
+            schema_ = schema;
+        } else if (schema_ != schema) {
+            return Error::SchemaMismatch;
+        }
+        if (size_ - pos_ < Layout::size)
+            return Error::CorruptedArchive;
+        uint8_t bad = load_fields(data_ + pos_, std::index_sequence_for<ArgsT...>(), args...);
+        if (bad)
+            return Error::CorruptedArchive;
+        pos_ += Layout::size;
+        return Error::NoError;
+    }
+
+    /* true when all records are read */
+    bool done() const { return pos_ == size_; }
+
+private:
+    /* bools take the low bit; any other bit set marks the record bad */
+    template <class T>
+    static uint8_t load_field(const uint8_t *p, T &arg)
+    {
+        if constexpr (std::is_same<T, bool>::value) {
+            arg = *p & 1;
+            return *p >> 1;
+        } else {
+            std::memcpy(&arg, p, sizeof arg);
+            return 0;
+        }
+    }
+
+    template <size_t... I, class... ArgsT>
+    static uint8_t load_fields(const uint8_t *p, std::index_sequence<I...>, ArgsT&... args)
+    {
+        constexpr auto offsets = RecordLayout<ArgsT...>::offsets();
+        return (load_field(p + offsets[I], args) | ... | 0);
+    }
+};
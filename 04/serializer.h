@@ -3,14 +3,25 @@
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <algorithm>
 #include <stdexcept>
+#include <type_traits>
 
 enum class Error
 {
     NoError,
-    CorruptedArchive
+    CorruptedArchive,
+    SchemaMismatch
 };
 
+/* Arrays of these are copied as one block in host byte order; bools
+ * are excluded as any byte other than 0 or 1 must be rejected */
+template <class T>
+constexpr bool is_bulk = std::is_arithmetic<T>::value && !std::is_same<T, bool>::value;
+
 static constexpr char Separator = ' ';
 static constexpr const char *True = "true";
 static constexpr const char *False = "false";
@@ -37,7 +48,7 @@ public:
     }
 
 private:
-    Error process(bool arg)
+    Error write(bool arg)
     {
         if (arg)
             out_ << True;
@@ -46,16 +57,88 @@ private:
         return Error::NoError;
     }
 
-    Error process(uint64_t arg)
+    Error write(uint64_t arg)
     {
         out_ << arg;
         return Error::NoError;
     }
-    
+
+    /* length, separator and raw bytes */
+    Error write(const std::string &arg)
+    {
+        out_ << arg.size() << Separator;
+        out_.write(arg.data(), arg.size());
+        return Error::NoError;
+    }
+
+    /* containers: element count unless it is fixed, then elements;
+     * numeric vectors are written like strings, count and raw bytes,
+     * numeric arrays as raw bytes only */
+    template <class T>
+    Error write(const std::vector<T> &arg)
+    {
+        write(uint64_t(arg.size()));
+        if constexpr (is_bulk<T>) {
+            out_ << Separator;
+            out_.write(reinterpret_cast<const char *>(arg.data()), arg.size() * sizeof(T));
+        } else {
+            for (const auto &x : arg) {
+                out_ << Separator;
+                Error e = write(x);
+                if (e != Error::NoError)
+                    return e;
+            }
+        }
+        return Error::NoError;
+    }
+
+    template <class T, size_t N>
+    Error write(const std::array<T, N> &arg)
+    {
+        if constexpr (is_bulk<T>) {
+            out_.write(reinterpret_cast<const char *>(arg.data()), N * sizeof(T));
+        } else {
+            for (size_t i = 0; i < N; ++i) {
+                if (i)
+                    out_ << Separator;
+                Error e = write(arg[i]);
+                if (e != Error::NoError)
+                    return e;
+            }
+        }
+        return Error::NoError;
+    }
+
+    template <class K, class V, class C>
+    Error write(const std::map<K, V, C> &arg)
+    {
+        write(uint64_t(arg.size()));
+        for (const auto &x : arg) {
+            out_ << Separator;
+            Error e = process(x.first, x.second);
+            if (e != Error::NoError)
+                return e;
+        }
+        return Error::NoError;
+    }
+
+    /* nested structs */
+    template <class T>
+    auto write(const T &arg) -> decltype(arg.serialize(*this))
+    {
+        return arg.serialize(*this);
+    }
+
+    template <class T>
+    Error process(T&& arg)
+    {
+        return write(arg);
+    }
+
     template <class T, class... ArgsT>
     Error process(T&& arg, ArgsT&&... args)
     {
-        Error e = process(std::forward<T>(arg));
+        Error e = write(arg);
         if (e == Error::NoError) {
             out_ << Separator;
             return process(std::forward<ArgsT>(args)...);
@@ -88,7 +171,16 @@ public:
     }
 
 private:
-    Error process(bool &arg)
+    /* strings and containers are read in pieces, so a corrupted
+     * length fails on end of stream before allocating much */
+    static constexpr size_t Chunk = 1 << 16;
+
+    Error separator()
+    {
+        return in_.get() == Separator ? Error::NoError : Error::CorruptedArchive;
+    }
+
+    Error read(bool &arg)
     {
         std::string s;
         in_ >> s;
@@ -100,7 +192,7 @@ private:
             return Error::CorruptedArchive;
         return Error::NoError;
     }
-    Error process(uint64_t &arg)
+    Error read(uint64_t &arg)
     {
         std::string s;
         in_ >> s;
@@ -111,11 +203,112 @@ private:
             return Error::CorruptedArchive;
         }
     }
-    
+
+    Error read(std::string &arg)
+    {
+        uint64_t n;
+        Error e = read(n);
+        if (e == Error::NoError)
+            e = separator();
+        if (e != Error::NoError)
+            return e;
+        arg.clear();
+        while (n) {
+            size_t len = std::min<uint64_t>(n, Chunk);
+            size_t old = arg.size();
+            arg.resize(old + len);
+            if (!in_.read(&arg[old], len))
+                return Error::CorruptedArchive;
+            n -= len;
+        }
+        return Error::NoError;
+    }
+
+    template <class T>
+    Error read(std::vector<T> &arg)
+    {
+        uint64_t n;
+        Error e = read(n);
+        if (e != Error::NoError)
+            return e;
+        arg.clear();
+        if constexpr (is_bulk<T>) {
+            if ((e = separator()) != Error::NoError)
+                return e;
+            while (n) {
+                size_t len = std::min<uint64_t>(n, Chunk);
+                size_t old = arg.size();
+                arg.resize(old + len);
+                if (!in_.read(reinterpret_cast<char *>(&arg[old]), len * sizeof(T)))
+                    return Error::CorruptedArchive;
+                n -= len;
+            }
+        } else {
+            arg.reserve(std::min<uint64_t>(n, Chunk));
+            for (uint64_t i = 0; i < n; ++i) {
+                T x;
+                if ((e = separator()) != Error::NoError || (e = read(x)) != Error::NoError)
+                    return e;
+                arg.push_back(std::move(x));
+            }
+        }
+        return Error::NoError;
+    }
+
+    template <class T, size_t N>
+    Error read(std::array<T, N> &arg)
+    {
+        if constexpr (is_bulk<T>) {
+            if (!in_.read(reinterpret_cast<char *>(arg.data()), N * sizeof(T)))
+                return Error::CorruptedArchive;
+        } else {
+            for (size_t i = 0; i < N; ++i) {
+                Error e = i ? separator() : Error::NoError;
+                if (e == Error::NoError)
+                    e = read(arg[i]);
+                if (e != Error::NoError)
+                    return e;
+            }
+        }
+        return Error::NoError;
+    }
+
+    /* repeated keys are not written by Serializer */
+    template <class K, class V, class C>
+    Error read(std::map<K, V, C> &arg)
+    {
+        uint64_t n;
+        Error e = read(n);
+        if (e != Error::NoError)
+            return e;
+        arg.clear();
+        for (uint64_t i = 0; i < n; ++i) {
+            K key;
+            V value;
+            if ((e = separator()) != Error::NoError || (e = process(key, value)) != Error::NoError)
+                return e;
+            if (!arg.emplace(std::move(key), std::move(value)).second)
+                return Error::CorruptedArchive;
+        }
+        return Error::NoError;
+    }
+
+    template <class T>
+    auto read(T &arg) -> decltype(arg.deserialize(*this))
+    {
+        return arg.deserialize(*this);
+    }
+
+    template <class T>
+    Error process(T &arg)
+    {
+        return read(arg);
+    }
+
     template <class T, class... ArgsT>
     Error process(T &arg, ArgsT&... args)
     {
-        Error e = process(arg);
+        Error e = read(arg);
         if (e == Error::NoError) {
             int c = in_.get();
             if (c != Separator)
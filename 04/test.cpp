@@ -1,8 +1,25 @@
+#include <iostream>
 #include <sstream>
 #include <cstdint>
-#include <cassert>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <algorithm>
 
 #include "serializer.h"
+#include "binary.h"
+#include "view.h"
+#include "record.h"
+#include "batch.h"
+#include "crc32c.h"
+
+static int failures = 0;
+
+/* unlike assert, kept with NDEBUG, so the operations under test always run */
+#define check(cond) do { if (!(cond)) { ++failures; std::cerr << "line " << __LINE__ << ": " << #cond << '\n'; } } while(0)
 
 struct Data
 {
@@ -23,8 +40,109 @@ struct Data
     }
 };
 
+bool
+same(const Data &x, const Data &y)
+{
+    return x.a == y.a && x.b == y.b && x.c == y.c;
+}
+
+struct Record
+{
+    std::string name;
+    std::vector<double> values;
+    std::vector<std::string> tags;
+    std::vector<bool> flags;
+    std::array<uint64_t, 3> ids;
+    std::map<std::string, uint64_t> counts;
+    Data data;
+    std::vector<Data> history;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(name, values, tags, flags, ids, counts, data, history);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(name, values, tags, flags, ids, counts, data, history);
+    }
+
+    bool operator==(const Record &r) const
+    {
+        return name == r.name && values == r.values && tags == r.tags && flags == r.flags &&
+            ids == r.ids && counts == r.counts &&
+            same(data, r.data) && std::equal(history.begin(), history.end(),
+                r.history.begin(), r.history.end(), same);
+    }
+};
+
+/* the same record read in place */
+struct RecordView
+{
+    std::string_view name;
+    Span<double> values;
+    std::vector<std::string_view> tags;
+    std::array<uint64_t, 3> ids;
+    Data data;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(name, values, tags, ids, data);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(name, values, tags, ids, data);
+    }
+};
+
+struct RecordCopy
+{
+    std::string name;
+    std::vector<double> values;
+    std::vector<std::string> tags;
+    std::array<uint64_t, 3> ids;
+    Data data;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(name, values, tags, ids, data);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(name, values, tags, ids, data);
+    }
+};
+
+/* Data with fields in another order */
+struct Swapped
+{
+    uint64_t a;
+    uint64_t c;
+    bool b;
+
+    template <class Serializer>
+    Error serialize(Serializer& serializer) const
+    {
+        return serializer(a, c, b);
+    }
+
+    template <class Deserializer>
+    Error deserialize(Deserializer& deserializer)
+    {
+        return deserializer(a, c, b);
+    }
+};
+
 int
-main(int argc, char *argv[])
+main()
 {
     Data x { 1, true, 2 };
 
@@ -37,11 +155,269 @@ main(int argc, char *argv[])
     Deserializer deserializer(stream);
     const Error err = deserializer.load(y);
 
-    assert(err == Error::NoError);
+    check(err == Error::NoError);
+
+    check(x.a == y.a);
+    check(x.b == y.b);
+    check(x.c == y.c);
+
+    ByteBuffer buffer(1);
+    BinarySerializer binary(buffer);
+    Data big { UINT64_MAX, false, 300 };
+    check(binary.save(x) == Error::NoError);
+    check(binary.save(big) == Error::NoError);
+    check(buffer.size() == 3 + 10 + 1 + 2);
 
-    assert(x.a == y.a);
-    assert(x.b == y.b);
-    assert(x.c == y.c);
+    BinaryDeserializer reader(buffer);
+    Data z { 0, false, 0 };
+    check(reader.load(z) == Error::NoError);
+    check(z.a == x.a && z.b == x.b && z.c == x.c);
+    check(reader.load(z) == Error::NoError);
+    check(z.a == big.a && z.b == big.b && z.c == big.c);
+    check(reader.position() == buffer.size());
+    check(reader.load(z) == Error::CorruptedArchive);
+
+    const uint8_t bad_bool[] = { 1, 2, 3 };
+    BinaryDeserializer bad_bool_reader(bad_bool, sizeof bad_bool);
+    check(bad_bool_reader.load(z) == Error::CorruptedArchive);
+    const uint8_t too_long[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02, 0, 0 };
+    BinaryDeserializer too_long_reader(too_long, sizeof too_long);
+    check(too_long_reader.load(z) == Error::CorruptedArchive);
+
+    Record r1;
+    r1.name = "two words";
+    r1.values = { 0.5, -1, 1e300 };
+    r1.tags = { "", "a b", "c" };
+    r1.flags = { true, false, true };
+    r1.ids = { 1, 2, UINT64_MAX };
+    r1.counts = { { "x", 1 }, { "y z", 2 } };
+    r1.data = big;
+    r1.history = { x, big };
+
+    std::stringstream text;
+    Serializer(text).save(r1);
+    Record r2;
+    check(Deserializer(text).load(r2) == Error::NoError);
+    check(r1 == r2);
+    /* values are raw bytes after their count */
+    std::string text_bytes = text.str();
+    check(text_bytes.compare(0, 14, "9 two words 3 ") == 0);
+    check(text_bytes.compare(14, sizeof(double), reinterpret_cast<const char *>(&r1.values[0]), sizeof(double)) == 0);
+    std::stringstream truncated(text_bytes.substr(0, 14 + 10));
+    check(Deserializer(truncated).load(r2) == Error::CorruptedArchive);
+
+    /* numeric arrays are raw bytes without count */
+    std::array<double, 4> point { 0.25, -2, 1e-300, 3 }, point2 {};
+    std::array<bool, 2> pair { true, false }, pair2 {};
+    std::stringstream point_text;
+    check(Serializer(point_text)(point, pair) == Error::NoError);
+    check(point_text.str().size() == sizeof point + 1 + 10);
+    check(Deserializer(point_text)(point2, pair2) == Error::NoError);
+    check(point == point2 && pair == pair2);
+    std::stringstream short_point(point_text.str().substr(0, sizeof point - 1));
+    check(Deserializer(short_point)(point2) == Error::CorruptedArchive);
+
+    buffer.clear();
+    check(binary.save(r1) == Error::NoError);
+    Record r3;
+    BinaryDeserializer record_reader(buffer);
+    check(record_reader.load(r3) == Error::NoError);
+    check(r1 == r3);
+    for (size_t n = 0; n < buffer.size(); ++n) {
+        BinaryDeserializer truncated(buffer.data(), n);
+        check(truncated.load(r3) == Error::CorruptedArchive);
+    }
+
+    buffer.clear();
+    AlignedSerializer aligned(buffer);
+    RecordCopy c1 { r1.name, r1.values, r1.tags, r1.ids, r1.data };
+    check(aligned.save(c1) == Error::NoError);
+    check(aligned.save(x) == Error::NoError);
+    check(buffer.size() % AlignedWord == 0);
+
+    ViewDeserializer view_reader(buffer);
+    RecordView v;
+    check(view_reader.load(v) == Error::NoError);
+    check(v.name == r1.name);
+    check(v.values.size() == 3 && v.values[2] == 1e300);
+    check(reinterpret_cast<uintptr_t>(v.values.data()) % alignof(double) == 0);
+    check(v.values.data() > reinterpret_cast<const double *>(buffer.data()));
+    check(v.tags.size() == 3 && v.tags[1] == "a b");
+    check(v.ids == r1.ids && same(v.data, r1.data));
+    check(!view_reader.done());
+    check(view_reader.load(z) == Error::NoError && same(z, x));
+    check(view_reader.done());
+    check(view_reader.load(z) == Error::CorruptedArchive);
+
+    RecordCopy c2;
+    ViewDeserializer copy_reader(buffer);
+    check(copy_reader.load(c2) == Error::NoError);
+    check(c2.name == c1.name && c2.values == c1.values && c2.tags == c1.tags);
+
+    /* header size no longer matches */
+    ViewDeserializer short_reader(buffer.data(), buffer.size() - 1);
+    check(short_reader.load(v) == Error::CorruptedArchive);
+    /* name length beyond the end */
+    buffer.data()[sizeof(AlignedHeader) + 7] = 0x80;
+    ViewDeserializer long_reader(buffer);
+    check(long_reader.load(v) == Error::CorruptedArchive);
+
+    /* fields written and read without save() and load() */
+    buffer.clear();
+    AlignedSerializer fields(buffer);
+    check(fields(x.a, x.b, x.c) == Error::NoError);
+    check(fields(std::string("tail")) == Error::NoError);
+    ViewDeserializer field_reader(buffer);
+    std::string tail;
+    check(field_reader(z.a, z.b, z.c) == Error::NoError && same(z, x));
+    check(field_reader(tail) == Error::NoError && tail == "tail");
+    check(field_reader.done());
+    ViewDeserializer short_fields(buffer.data(), buffer.size() - AlignedWord);
+    check(short_fields(z.a) == Error::CorruptedArchive);
+
+    static_assert(RecordLayout<uint64_t, bool, uint64_t>::size == 17, "packed layout");
+    static_assert(RecordLayout<uint64_t, bool, uint64_t>::offsets()[2] == 9, "packed layout");
+    static_assert(RecordLayout<uint64_t, bool, uint64_t>::schema() !=
+            RecordLayout<uint64_t, uint64_t, bool>::schema(), "order matters");
+    static_assert(RecordLayout<uint64_t>::schema() != RecordLayout<double>::schema(), "kind matters");
+
+    buffer.clear();
+    RecordSerializer records(buffer);
+    check(records.save(x) == Error::NoError);
+    check(records.save(big) == Error::NoError);
+    check(buffer.size() == sizeof(RecordHeader) + 2 * 17);
+    Swapped w { 1, 2, true };
+    check(records.save(w) == Error::SchemaMismatch);
+
+    RecordDeserializer record_reader2(buffer);
+    check(record_reader2.load(z) == Error::NoError && same(z, x));
+    check(record_reader2.load(z) == Error::NoError && same(z, big));
+    check(record_reader2.done());
+    check(record_reader2.load(z) == Error::CorruptedArchive);
+
+    RecordDeserializer swapped_reader(buffer);
+    check(swapped_reader.load(w) == Error::SchemaMismatch);
+
+    buffer.data()[sizeof(RecordHeader) + 8] = 2;
+    RecordDeserializer bad_record_reader(buffer);
+    check(bad_record_reader.load(z) == Error::CorruptedArchive);
+    RecordDeserializer empty_reader(buffer.data(), 3);
+    check(empty_reader.load(z) == Error::CorruptedArchive);
+
+    std::vector<uint8_t> plain(10000);
+    for (size_t i = 0; i < plain.size(); ++i)
+        plain[i] = i % 251 < 100 ? 'a' + i % 7 : uint8_t(i * 2654435761u >> 24);
+    for (size_t n : { size_t(0), size_t(3), size_t(17), plain.size() }) {
+        ByteBuffer packed(1);
+        size_t len = lz_compress(plain.data(), n, packed);
+        check(len == packed.size() && len <= lz_bound(n));
+        std::vector<uint8_t> unpacked(n);
+        check(lz_decompress(packed.data(), len, unpacked.data(), n));
+        check(std::equal(unpacked.begin(), unpacked.end(), plain.begin()));
+        if (n)
+            check(!lz_decompress(packed.data(), len, unpacked.data(), n - 1));
+        for (size_t cut = 0; cut < len; cut += 7)
+            lz_decompress(packed.data(), cut, unpacked.data(), n);
+    }
+
+    for (bool compress : { false, true }) {
+        std::stringstream batched;
+        std::vector<Data> many(1000);
+        for (size_t i = 0; i < many.size(); ++i)
+            many[i] = Data { i, i % 3 == 0, i * i };
+        {
+            BatchWriter<> writer(batched, compress, 256);
+            check(writer.save(many.begin(), many.end()) == Error::NoError);
+        }
+        BatchReader<> batch_reader(batched);
+        for (auto &d : many) {
+            check(batch_reader.load(z) == Error::NoError);
+            check(same(z, d));
+        }
+        check(batch_reader.done());
+        check(batch_reader.load(z) == Error::CorruptedArchive);
+
+        batched.clear();
+        batched.seekg(0);
+        BatchReader<> skipping_reader(batched);
+        uint64_t skipped, total = 0;
+        check(skipping_reader.skip_chunk(skipped) == Error::NoError && skipped > 0);
+        total += skipped;
+        check(skipping_reader.load(z) == Error::NoError && same(z, many[total]));
+        check(skipping_reader.skip_chunk(skipped) == Error::NoError);
+        total += skipped + 1;
+        while (!skipping_reader.done()) {
+            check(skipping_reader.skip_chunk(skipped) == Error::NoError);
+            total += skipped;
+        }
+        check(total == many.size());
+    }
+
+    {
+        std::stringstream batched;
+        {
+            BatchWriter<RecordSerializer> writer(batched, true, 100);
+            for (uint64_t i = 0; i < 100; ++i)
+                check(writer.save(Data { i, true, 7 }) == Error::NoError);
+        }
+        BatchReader<RecordDeserializer> batch_reader(batched);
+        for (uint64_t i = 0; i < 100; ++i)
+            check(batch_reader.load(z) == Error::NoError && z.a == i && z.c == 7);
+        check(batch_reader.done());
+    }
+
+    check(crc32c(0, "123456789", 9) == 0xe3069283);
+    check(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xe3069283);
+    check(crc32c(0, plain.data(), 1000) == crc32c(crc32c(0, plain.data(), 3), plain.data() + 3, 997));
+    check(~crc32c_table(~0u, plain.data() + 1, 999) == crc32c(0, plain.data() + 1, 999));
+
+    for (bool compress : { false, true }) {
+        std::vector<Data> many(300);
+        for (size_t i = 0; i < many.size(); ++i)
+            many[i] = Data { i, true, i % 5 };
+        std::stringstream batched;
+        {
+            BatchWriter<> writer(batched, compress, 64);
+            check(writer.save(many.begin(), many.end()) == Error::NoError);
+        }
+        std::string bytes = batched.str();
+        std::vector<size_t> starts;
+        for (size_t at = 0; at < bytes.size(); ) {
+            ChunkHeader h;
+            std::memcpy(&h, bytes.data() + at, sizeof h);
+            starts.push_back(at);
+            at += sizeof h + h.stored_size;
+        }
+        check(starts.size() > 5);
+        if (starts.size() <= 5)
+            continue;
+        /* flip a payload byte of the second chunk and a header byte of the fourth */
+        bytes[starts[1] + sizeof(ChunkHeader) + 2] ^= 0x10;
+        bytes[starts[3] + offsetof(ChunkHeader, records)] ^= 1;
+        /* and cut the last chunk short */
+        bytes.resize(bytes.size() - 3);
+
+        std::stringstream damaged(bytes);
+        BatchReader<> strict(damaged);
+        Error e = Error::NoError;
+        for (size_t i = 0; i < many.size() && e == Error::NoError; ++i)
+            e = strict.load(z);
+        check(e == Error::CorruptedArchive);
+
+        std::stringstream damaged_again(bytes);
+        BatchReader<> resilient(damaged_again, true);
+        size_t loaded = 0;
+        uint64_t last = 0;
+        while (resilient.load(z) == Error::NoError) {
+            check(z.a >= last && same(z, many[z.a]));
+            last = z.a;
+            ++loaded;
+        }
+        check(resilient.done());
+        check(loaded > 0 && loaded < many.size());
+        const std::vector<uint64_t> &bad = resilient.corrupted();
+        check(bad.size() == 3 && bad[0] == starts[1] && bad[1] == starts[3] && bad[2] == starts.back());
+    }
 
-    return 0;
+    return failures ? 1 : 0;
 }
@@ -0,0 +1,439 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "serializer.h"
+#include "binary.h"
+
+/* Read-only view of count elements stored in an archive */
+template <class T>
+class Span
+{
+    const T *ptr_;
+    size_t size_;
+public:
+    Span()
+        : ptr_(nullptr), size_(0)
+    {
+    }
+
+    Span(const T *ptr, size_t size)
+        : ptr_(ptr), size_(size)
+    {
+    }
+
+    Span(const std::vector<T> &v)
+        : ptr_(v.data()), size_(v.size())
+    {
+    }
+
+    const T &operator[](size_t i) const { return ptr_[i]; }
+    const T *data() const { return ptr_; }
+    const T *begin() const { return ptr_; }
+    const T *end() const { return ptr_ + size_; }
+    size_t size() const { return size_; }
+};
+
+/* Aligned archive: 16-byte header with magic and payload size, then
+ * fields at offsets aligned to their size. uint64_t and lengths take 8
+ * bytes at 8-byte boundary, bools one byte, strings and arrays of
+ * numbers their length followed by raw bytes in host order. Offsets of
+ * a record depend only on lengths before them, so fields can be read in
+ * place from a mapping. */
+struct AlignedHeader
+{
+    char magic[8];
+    uint64_t size;
+};
+
+static constexpr char AlignedMagic[8] = { 'S', 'E', 'R', 'I', 'A', 'L', '0', '1' };
+static constexpr size_t AlignedWord = 8;
+
+template <class T>
+constexpr bool is_aligned_bulk = is_bulk<T> && alignof(T) <= AlignedWord;
+
+class AlignedSerializer
+{
+    ByteBuffer &out_;
+    size_t base_;
+
+    void pad(size_t align)
+    {
+        size_t n = (align - (out_.size() - base_) % align) % align;
+        std::memset(out_.reserve(n), 0, n);
+        out_.commit(n);
+    }
+
+    void update_size()
+    {
+        uint64_t size = out_.size() - base_ - sizeof(AlignedHeader);
+        std::memcpy(out_.data() + base_ + offsetof(AlignedHeader, size), &size, sizeof size);
+    }
+public:
+    /* archive starts at next 8-byte boundary of out */
+    explicit AlignedSerializer(ByteBuffer &out)
+        : out_(out), base_(0)
+    {
+        pad(AlignedWord);
+        base_ = out_.size();
+        AlignedHeader h;
+        std::memcpy(h.magic, AlignedMagic, sizeof h.magic);
+        h.size = 0;
+        out_.append(&h, sizeof h);
+    }
+
+    template <class T>
+    Error save(const T& object)
+    {
+        Error e = object.serialize(*this);
+        update_size();
+        return e;
+    }
+
+    /* fields written directly are counted in the header as well */
+    template <class... ArgsT>
+    Error operator()(ArgsT&&... args)
+    {
+        Error e = process(std::forward<ArgsT>(args)...);
+        update_size();
+        return e;
+    }
+
+private:
+    Error write(bool arg)
+    {
+        *out_.reserve(1) = arg;
+        out_.commit(1);
+        return Error::NoError;
+    }
+
+    Error write(uint64_t arg)
+    {
+        pad(AlignedWord);
+        out_.append(&arg, sizeof arg);
+        return Error::NoError;
+    }
+
+    Error write(std::string_view arg)
+    {
+        write(uint64_t(arg.size()));
+        out_.append(arg.data(), arg.size());
+        return Error::NoError;
+    }
+
+    Error write(const std::string &arg)
+    {
+        return write(std::string_view(arg));
+    }
+
+    template <class T>
+    Error write(Span<T> arg)
+    {
+        static_assert(is_aligned_bulk<T>, "spans hold numbers only");
+        write(uint64_t(arg.size()));
+        out_.append(arg.data(), arg.size() * sizeof(T));
+        return Error::NoError;
+    }
+
+    template <class T>
+    Error write(const std::vector<T> &arg)
+    {
+        if constexpr (is_aligned_bulk<T>) {
+            return write(Span<T>(arg));
+        } else {
+            write(uint64_t(arg.size()));
+            for (const auto &x : arg) {
+                Error e = write(x);
+                if (e != Error::NoError)
+                    return e;
+            }
+            return Error::NoError;
+        }
+    }
+
+    template <class T, size_t N>
+    Error write(const std::array<T, N> &arg)
+    {
+        if constexpr (is_aligned_bulk<T>) {
+            pad(AlignedWord);
+            out_.append(arg.data(), N * sizeof(T));
+            return Error::NoError;
+        } else {
+            for (const auto &x : arg) {
+                Error e = write(x);
+                if (e != Error::NoError)
+                    return e;
+            }
+            return Error::NoError;
+        }
+    }
+
+    template <class T>
+    auto write(const T &arg) -> decltype(arg.serialize(*this))
+    {
+        return arg.serialize(*this);
+    }
+
+    template <class T>
+    Error process(T&& arg)
+    {
+        return write(arg);
+    }
+
+    template <class T, class... ArgsT>
+    Error process(T&& arg, ArgsT&&... args)
+    {
+        Error e = write(arg);
+        if (e == Error::NoError)
+            return process(std::forward<ArgsT>(args)...);
+        return e;
+    }
+};
+
+/* Reads an aligned archive in place. The header is checked against the
+ * buffer size once; afterwards every length is checked against the rest
+ * of the buffer before a view is formed, so payload bytes are never read
+ * by validation. string_view and Span fields point into the buffer and
+ * live as long as it does; std::string and std::vector fields are copied. */
+class ViewDeserializer
+{
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_;
+    Error state_;
+
+    const uint8_t *take(size_t n, size_t align)
+    {
+        size_t at = (pos_ + align - 1) / align * align;
+        if (at > size_ || size_ - at < n)
+            return nullptr;
+        pos_ = at + n;
+        return data_ + at;
+    }
+public:
+    /* data must be 8-byte aligned, as mappings and malloc'ed buffers are */
+    ViewDeserializer(const uint8_t *data, size_t size)
+        : data_(data), size_(size), pos_(sizeof(AlignedHeader)), state_(Error::CorruptedArchive)
+    {
+        AlignedHeader h;
+        if (reinterpret_cast<uintptr_t>(data) % AlignedWord || size < sizeof h)
+            return;
+        std::memcpy(&h, data, sizeof h);
+        if (std::memcmp(h.magic, AlignedMagic, sizeof h.magic) || h.size != size - sizeof h)
+            return;
+        state_ = Error::NoError;
+    }
+
+    explicit ViewDeserializer(const ByteBuffer &in)
+        : ViewDeserializer(in.data(), in.size())
+    {
+    }
+
+    template <class T>
+    Error load(T& object)
+    {
+        if (state_ != Error::NoError)
+            return state_;
+        return object.deserialize(*this);
+    }
+
+    template <class... ArgsT>
+    Error operator()(ArgsT&... args)
+    {
+        if (state_ != Error::NoError)
+            return state_;
+        return process(args...);
+    }
+
+    /* true when all records are read */
+    bool done() const { return state_ != Error::NoError || pos_ == size_; }
+
+private:
+    Error read(bool &arg)
+    {
+        const uint8_t *p = take(1, 1);
+        if (!p || *p > 1)
+            return Error::CorruptedArchive;
+        arg = *p;
+        return Error::NoError;
+    }
+
+    Error read(uint64_t &arg)
+    {
+        const uint8_t *p = take(sizeof arg, AlignedWord);
+        if (!p)
+            return Error::CorruptedArchive;
+        std::memcpy(&arg, p, sizeof arg);
+        return Error::NoError;
+    }
+
+    /* count elements of size bytes each, positioned at the first one */
+    template <class T>
+    Error read_block(const T *&p, uint64_t &n)
+    {
+        Error e = read(n);
+        if (e != Error::NoError)
+            return e;
+        if (n > (size_ - pos_) / sizeof(T))
+            return Error::CorruptedArchive;
+        p = reinterpret_cast<const T *>(take(n * sizeof(T), 1));
+        return Error::NoError;
+    }
+
+    Error read(std::string_view &arg)
+    {
+        const char *p;
+        uint64_t n;
+        Error e = read_block(p, n);
+        if (e == Error::NoError)
+            arg = std::string_view(p, n);
+        return e;
+    }
+
+    Error read(std::string &arg)
+    {
+        std::string_view v;
+        Error e = read(v);
+        if (e == Error::NoError)
+            arg.assign(v);
+        return e;
+    }
+
+    template <class T>
+    Error read(Span<T> &arg)
+    {
+        static_assert(is_aligned_bulk<T>, "spans hold numbers only");
+        const T *p;
+        uint64_t n;
+        Error e = read_block(p, n);
+        if (e == Error::NoError)
+            arg = Span<T>(p, n);
+        return e;
+    }
+
+    template <class T>
+    Error read(std::vector<T> &arg)
+    {
+        if constexpr (is_aligned_bulk<T>) {
+            Span<T> v;
+            Error e = read(v);
+            if (e == Error::NoError)
+                arg.assign(v.begin(), v.end());
+            return e;
+        } else {
+            uint64_t n;
+            Error e = read(n);
+            if (e != Error::NoError)
+                return e;
+            arg.clear();
+            arg.reserve(std::min<uint64_t>(n, size_ - pos_));
+            for (uint64_t i = 0; i < n; ++i) {
+                T x;
+                if ((e = read(x)) != Error::NoError)
+                    return e;
+                arg.push_back(std::move(x));
+            }
+            return Error::NoError;
+        }
+    }
+
+    template <class T, size_t N>
+    Error read(std::array<T, N> &arg)
+    {
+        if constexpr (is_aligned_bulk<T>) {
+            const uint8_t *p = take(N * sizeof(T), AlignedWord);
+            if (!p)
+                return Error::CorruptedArchive;
+            std::memcpy(arg.data(), p, N * sizeof(T));
+            return Error::NoError;
+        } else {
+            for (auto &x : arg) {
+                Error e = read(x);
+                if (e != Error::NoError)
+                    return e;
+            }
+            return Error::NoError;
+        }
+    }
+
+    template <class T>
+    auto read(T &arg) -> decltype(arg.deserialize(*this))
+    {
+        return arg.deserialize(*this);
+    }
+
+    template <class T>
+    Error process(T &arg)
+    {
+        return read(arg);
+    }
+
+    template <class T, class... ArgsT>
+    Error process(T &arg, ArgsT&... args)
+    {
+        Error e = read(arg);
+        if (e == Error::NoError)
+            return process(args...);
+        return e;
+    }
+};
+
+/* Read-only mapping of a whole archive file */
+class MappedArchive
+{
+    int fd_;
+    size_t size_;
+    void *ptr_;
+
+    MappedArchive(const MappedArchive &);
+    MappedArchive &operator=(const MappedArchive &);
+public:
+    explicit MappedArchive(const std::string &filename)
+        : size_(0), ptr_(MAP_FAILED)
+    {
+        fd_ = open(filename.c_str(), O_RDONLY);
+        if (fd_ == -1)
+            throw std::runtime_error("Can't open file '" + filename + "'");
+        struct stat st;
+        if (fstat(fd_, &st) == -1) {
+            close(fd_);
+            throw std::runtime_error("Can't stat file '" + filename + "'");
+        }
+        size_ = st.st_size;
+        if (size_) {
+            ptr_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (ptr_ == MAP_FAILED) {
+                close(fd_);
+                throw std::runtime_error("Can't mmap file '" + filename + "'");
+            }
+        }
+    }
+
+    ~MappedArchive()
+    {
+        if (ptr_ != MAP_FAILED)
+            munmap(ptr_, size_);
+        close(fd_);
+    }
+
+    const uint8_t *data() const
+    {
+        return size_ ? static_cast<const uint8_t *>(ptr_) : nullptr;
+    }
+
+    size_t size() const { return size_; }
+};
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <sys/resource.h>
+
+#include "handoff.h"
+
+/* Round trip latency of a ping-pong between two threads and CPU time
+ * spent by the process per second of wall time (2 means both threads
+ * busy all the time) */
+
+double
+cpu_seconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+template <class Handoff>
+void
+bench(const char *name, size_t rounds)
+{
+    using clock = std::chrono::steady_clock;
+    Handoff h;
+    std::vector<int64_t> rtt(rounds);
+
+    /* the other side answers every odd turn */
+    std::thread pong([&] {
+        for (uint64_t turn = 1; turn < 2 * rounds; turn += 2) {
+            h.wait_for(turn);
+            h.advance();
+        }
+    });
+
+    double cpu = cpu_seconds();
+    auto start = clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        auto t = clock::now();
+        h.advance();
+        h.wait_for(2 * i + 2);
+        rtt[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t).count();
+    }
+    double wall = std::chrono::duration<double>(clock::now() - start).count();
+    pong.join();
+    cpu = cpu_seconds() - cpu;
+
+    std::sort(rtt.begin(), rtt.end());
+    auto pct = [&](double p) { return rtt[std::min(rounds - 1, size_t(p * rounds))]; };
+    std::cout << name << '\t' << pct(0.5) << '\t' << pct(0.99) << '\t' << pct(0.999) << '\t'
+              << wall << '\t' << cpu / wall << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t rounds = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    std::string only = argc > 2 ? argv[2] : "";
+    if (!rounds) {
+        std::cerr << "Usage: bench [rounds] [spin|wait|condvar]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "strategy\tp50_ns\tp99_ns\tp999_ns\twall_sec\tcpu_per_wall" << std::endl;
+    if (only.empty() || only == "spin")
+        bench<SpinHandoff>("spin", rounds);
+#if __cpp_lib_atomic_wait
+    if (only.empty() || only == "wait")
+        bench<WaitHandoff>("wait", rounds);
+#endif
+    if (only.empty() || only == "condvar")
+        bench<CondVarHandoff>("condvar", rounds);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Turn counter shared by threads that take turns: a thread waits until
+ * the counter reaches its turn, works, then advances the counter to hand
+ * over. Writes made before advance() are visible after the matching
+ * wait_for() returns. Strategies differ in how the waiter waits. */
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Acquire/release spinning with exponential pause backoff; once the
+ * backoff is at its limit the waiter yields so it does not starve the
+ * other thread on an oversubscribed machine. Lowest latency, a core
+ * busy per waiter. */
+class SpinHandoff
+{
+    static constexpr unsigned MaxPauses = 64;
+
+    std::atomic<uint64_t> turn_;
+public:
+    SpinHandoff()
+        : turn_(0)
+    {
+    }
+
+    uint64_t value() const
+    {
+        return turn_.load(std::memory_order_acquire);
+    }
+
+    void wait_for(uint64_t turn)
+    {
+        unsigned pauses = 1;
+        while (turn_.load(std::memory_order_acquire) != turn) {
+            if (pauses > MaxPauses) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (unsigned i = 0; i < pauses; ++i)
+                cpu_relax();
+            pauses *= 2;
+        }
+    }
+
+    void advance()
+    {
+        turn_.store(turn_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+#if __cpp_lib_atomic_wait
+/* Spins briefly, then sleeps in atomic::wait (a futex on Linux). The
+ * waker only makes the notify system call when somebody sleeps; both
+ * sides use seq_cst so a sleeper either sees the new turn or is seen.
+ * On a single CPU nobody can advance while we spin, so we sleep at once. */
+class WaitHandoff
+{
+    static constexpr unsigned SpinPauses = 512;
+
+    std::atomic<uint64_t> turn_;
+    std::atomic<unsigned> sleepers_;
+    unsigned spin_;
+public:
+    WaitHandoff()
+        : turn_(0), sleepers_(0), spin_(std::thread::hardware_concurrency() > 1 ? SpinPauses : 0)
+    {
+    }
+
+    uint64_t value() const
+    {
+        return turn_.load(std::memory_order_acquire);
+    }
+
+    void wait_for(uint64_t turn)
+    {
+        for (unsigned i = 0; i < spin_; ++i) {
+            if (turn_.load(std::memory_order_acquire) == turn)
+                return;
+            cpu_relax();
+        }
+        sleepers_.fetch_add(1);
+        for (uint64_t seen; (seen = turn_.load()) != turn; )
+            turn_.wait(seen);
+        sleepers_.fetch_sub(1);
+    }
+
+    void advance()
+    {
+        turn_.store(turn_.load(std::memory_order_relaxed) + 1);
+        if (sleepers_.load())
+            turn_.notify_all();
+    }
+};
+#endif
+
+/* Mutex and condition variable: the waiter always sleeps, so every
+ * handoff costs a wakeup; lowest CPU use. */
+class CondVarHandoff
+{
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t turn_;
+public:
+    CondVarHandoff()
+        : turn_(0)
+    {
+    }
+
+    uint64_t value()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return turn_;
+    }
+
+    void wait_for(uint64_t turn)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return turn_ == turn; });
+    }
+
+    void advance()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++turn_;
+        }
+        cv_.notify_all();
+    }
+};
@@ -1,28 +1,56 @@
 #include <iostream>
-#include <atomic>
+#include <string>
 #include <thread>
 
-void proc(std::atomic<int> &x, int limit, int order)
+#include "handoff.h"
+
+template <class Handoff>
+void proc(Handoff &h, int limit, int order)
 {
-    limit -= 1 - order; 
-    while (x < limit) {
-        if (x % 2 == order) {
-            if (order)
-                std::cout << "pong" << std::endl;
-            else
-                std::cout << "ping" << std::endl;
-            ++x;
-        }
+    for (int turn = order; turn < limit; turn += 2) {
+        h.wait_for(turn);
+        if (order)
+            std::cout << "pong" << std::endl;
+        else
+            std::cout << "ping" << std::endl;
+        h.advance();
     }
 }
 
+template <class Handoff>
+void run(int N)
+{
+    Handoff h;
+    std::thread t1 = std::thread(proc<Handoff>, std::ref(h), N, 0);
+    proc(h, N, 1);
+    t1.join();
+}
+
+/* futex waiting when the library has atomic::wait, else the condition
+ * variable, which also sleeps instead of burning a core */
+#if __cpp_lib_atomic_wait
+static const char DefaultStrategy[] = "wait";
+#else
+static const char DefaultStrategy[] = "condvar";
+#endif
+
+/* test [spin|wait|condvar] */
 int
-main()
+main(int argc, char *argv[])
 {
     int N = 1000000;
-    std::atomic<int> x(0);
-    std::thread t1 = std::thread(proc, std::ref(x), N, 0);
-    proc(x, N, 1);
-    t1.join();
+    std::string strategy = argc > 1 ? argv[1] : DefaultStrategy;
+    if (strategy == "spin")
+        run<SpinHandoff>(N);
+#if __cpp_lib_atomic_wait
+    else if (strategy == "wait")
+        run<WaitHandoff>(N);
+#endif
+    else if (strategy == "condvar")
+        run<CondVarHandoff>(N);
+    else {
+        std::cerr << "unknown strategy " << strategy << std::endl;
+        return 1;
+    }
     return 0; 
 }